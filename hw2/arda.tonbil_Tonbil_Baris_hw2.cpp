@@ -1,424 +1,1375 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <sstream>
-
-using namespace std;
-
-struct DocumentItem {
-	string documentName;
-	int count;
-};
-
-struct WordItem {  //node structure
-	string word;
-	WordItem* left = nullptr;
-	WordItem* right = nullptr;
-	vector <DocumentItem> details = {};
-	int height;
-
-	WordItem(const string& word, WordItem* left = nullptr, WordItem* right = nullptr, int height = 0) :
-		word(word), left(left), right(right), height(height), details({}) {}
-
-
-};
-
-string tolower_string(string s);
-
-string tolower_string(string s) {  //embedded tolower function is used for chars so I defined a function to obtain lowercase strings
-	string last_string = "";
-	for (int i = 0; i < s.length(); i++) {
-		if ((s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z')) last_string += tolower(s[i]);
-		else {  //there are invalid characters (non alphabetical)
-			last_string = "";
-			break;
-		}
-	}
-	return last_string;
-}
-
-
-template <class Key, class Value>
-class AVLSearchTree
-{
-public:
-	AVLSearchTree();   //mostly taken from slides
-	~AVLSearchTree();
-	void insert(Key key) const;
-	void remove(Key key) const;
-	Value find(Key key) const;
-	Value findMin() const;
-	void makeEmpty();
-	bool isEmpty();
-	int getBalance(Value& ptr) const;
-
-	void rotateWithLeftChild(Value& k2) const;
-	void rotateWithRightChild(Value& k1) const;
-	void doubleWithLeftChild(Value& k3) const;
-	void doubleWithRightChild(Value& k1) const;
-
-
-private:  //used for default arguments
-	Value root = nullptr;  
-	void insert(Key key, Value& ptr) const;
-	void remove(Key key, Value& ptr) const;
-	void makeEmpty(Value& ptr) const;
-	Value find(Key key, Value ptr) const;  
-	Value findMin(Value ptr) const;
-	int getHeight(Value ptr) const;
-};
-
-template <class Key, class Value>
-AVLSearchTree<Key, Value>::AVLSearchTree() {   //constructor
-	root = nullptr;
-}
-
-template<class Key, class Value>
-AVLSearchTree<Key, Value>::~AVLSearchTree() {  //destructor
-	makeEmpty();
-}
-
-template<class Key, class Value>
-int AVLSearchTree<Key, Value>::getHeight(Value ptr) const   //it is used to handle nullptr->height case
-{
-	if (ptr == nullptr) return 0;
-	else return ptr->height;
-}
-
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::remove(Key key) const {  //root ptr is given default
-	remove(key, (Value&)root);
-}
-
-
-
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::makeEmpty() {   //root ptr is given default
-	makeEmpty((Value&)root);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::makeEmpty(Value& ptr) const {
-	if (ptr != nullptr) {
-		makeEmpty(ptr->left);  //recursively deleting the nodes
-		makeEmpty(ptr->right);
-		delete ptr;
-	}
-	ptr = nullptr;
-}
-
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::insert(Key key) const {   //root ptr is given default
-	insert(key, (Value&)root);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::insert(Key key, Value& ptr) const {
-	if (ptr == nullptr) {  //first node of tree
-		ptr = new WordItem(key, nullptr, nullptr, 0);
-	}
-
-	else if (key < ptr->word) {  //nodes are ordered as it is an AVL
-		insert(key, ptr->left);
-
-		if (getHeight(ptr->left) - getHeight(ptr->right) == 2) {  //balancing the tree
-			if (key < ptr->left->word) rotateWithLeftChild(ptr);
-			else doubleWithLeftChild(ptr);
-		}
-	}
-	
-	//same comments apply for this case too 
-
-	else if (ptr->word < key) {
-		insert(key, ptr->right); 
-		if (getHeight(ptr->right) - getHeight(ptr->left) == 2) {
-			if (key < ptr->right->word) rotateWithRightChild(ptr);
-			else doubleWithRightChild(ptr);
-		}
-	}
-
-
-	//new height values
-	if (ptr->left == nullptr && ptr->right == nullptr) ptr->height = 0;
-	else if (ptr->right == nullptr && ptr->left != nullptr) ptr->height = ptr->left->height + 1;
-	else if (ptr->left == nullptr && ptr->right != nullptr) ptr->height = ptr->right->height + 1;
-	else ptr->height = max(ptr->left->height, ptr->right->height) + 1;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::remove(Key key, Value& ptr) const {
-	if (ptr == nullptr) return;  //nothing to remove
-
-
-	if (key < ptr->word) {   //nodes are ordered from left to right alphabetically as it is an AVL
-		remove(key, ptr->left);
-		if (getBalance(ptr) > 1) {  //balancing the tree
-			if (key < ptr->left->word) {
-				rotateWithLeftChild(ptr);
-			}
-			else {
-				doubleWithLeftChild(ptr);
-			}
-		}
-	}
-
-	//same comments for this case
-	else if (key > ptr->word) {
-		remove(key, ptr->right);
-		if (getBalance(ptr) > 1) {
-			if (key > ptr->right->word) {
-				rotateWithRightChild(ptr);
-			}
-			else {
-				doubleWithRightChild(ptr);
-			}
-		}
-	}
-	else { //found the node with the word to remove
-		if (ptr->left == nullptr) {
-			Value temp = ptr;  //don't delete the ptr but you can delete temp
-			ptr = ptr->right;
-			delete temp;
-		}
-		else if (ptr->right == nullptr) {
-			Value temp = ptr;  //same comment
-			ptr = ptr->left;
-			delete temp;
-		}
-		else {  //two children for particular node
-			Value temp = findMin(ptr->right);
-			if (temp != nullptr) {
-				ptr->word = temp->word;
-				remove(temp->word, ptr->right);
-			}
-		}
-
-	}
-
-
-	//setting heights accurately
-	ptr->height = max(getHeight(ptr->left), getHeight(ptr->right)) + 1;
-	
-}
-
-
-template<class Key, class Value>
-int AVLSearchTree<Key, Value>::getBalance(Value& ptr) const {
-	if (ptr == nullptr) return 0;   //handling ptr = nullptr case
-	return getHeight(ptr->left) - getHeight(ptr->right);
-}
-
-
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::find(Key key) const
-{
-	return find(key, root);
-}
-
-
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::find(Key key, Value ptr) const
-{  //recursively finds the word
-	key = tolower_string(key); 
-	if (ptr == nullptr) return nullptr;  
-	else if (key < ptr->word) return find(key, ptr->left);
-	else if (key > ptr->word) return find(key, ptr->right);
-	else if (key == ptr->word) return ptr;  //found the word
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::findMin() const
-{
-	return findMin((Value&)root);
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::findMin(Value ptr) const
-{  //recursion again, but checks left only as order is from left to right
-	if (ptr == nullptr) return nullptr;
-	else if (ptr->left == nullptr) return ptr;
-	else return findMin(ptr->left);
-}
-
-
-
-template <class Key, class Value>
-bool AVLSearchTree<Key, Value>::isEmpty() {
-	return (root == nullptr); //if root is null, then there is no node
-}
-
-
-//rotation and doubling graphs in slides are used in doubling and rotating
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::rotateWithLeftChild(Value& k2) const {
-	if (k2 == nullptr || k2->left == nullptr) {
-		// Cannot perform rotation, k2 is nullptr or k2->left is nullptr
-		return;
-	}
-
-	
-	Value k1 = k2->left;
-	k2->left = k1->right;
-	k1->right = k2;
-	k2->height = max(getHeight(k2->left), getHeight(k2->right)) + 1;
-	k1->height = max(getHeight(k1->left), getHeight(k2)) + 1;
-	k2 = k1;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::rotateWithRightChild(Value& k1) const {
-	if (k1 == nullptr || k1->right == nullptr) {
-		// Cannot perform rotation, k1 is nullptr or k1->right is nullptr
-		return;
-	}
-
-	Value k2 = k1->right;
-	k1->right = k2->left;
-	k2->left = k1;
-	k1->height = max(getHeight(k1->left), getHeight(k1->right)) + 1;
-	k2->height = max(getHeight(k2->right), getHeight(k1)) + 1;
-	k1 = k2;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::doubleWithRightChild(Value& k1) const {
-	if (k1 == nullptr || k1->left == nullptr) {
-		// Cannot perform double rotation, k1 is nullptr or k1->left is nullptr
-		return;
-	}
-
-	rotateWithRightChild(k1->left);
-	rotateWithLeftChild(k1);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::doubleWithLeftChild(Value& k1) const {
-	if (k1 == nullptr || k1->left == nullptr) {
-		// Cannot perform double rotation, k1 is nullptr or k1->left is nullptr
-		return;
-	}
-
-	rotateWithLeftChild(k1->left);
-	rotateWithRightChild(k1);
-}
-
-
-
-
-
-int main()
-{
-	AVLSearchTree<string, WordItem*> myTree;
-	int fileNum;
-	cout << "Enter number of input files: ";
-	cin >> fileNum;
-	vector <string> filenames;
-	for (int i = 0; i < fileNum; i++) {
-		string new_filename;
-		cout << "Enter " << i + 1 << ". file name:";  //collecting filenames into the vector filenames
-		cin >> new_filename;
-		filenames.push_back(new_filename);
-	}
-
-	for (int i = 0; i < filenames.size(); i++) {
-		ifstream file(filenames[i]);
-		if (!file.is_open()) {  //wrong filename or missing file
-			cout << filenames[i] << " could not be opened!\n";
-		}
-
-		else {
-			string word, word_lower;
-			while (file >> word) { //starting to build the tree
-				word_lower = tolower_string(word);  //tolower again
-				if (word_lower.length() > 0 && myTree.find(word_lower) == nullptr) {  //word is new to tree (non alphabeticals are already eliminated)
-					myTree.insert(word_lower);
-					DocumentItem new_save; //documentitem is used to track the count in each document
-					new_save.documentName = filenames[i];
-					new_save.count = 1;  
-					myTree.find(word_lower)->details.push_back(new_save);  //finally the documentitem is stored in worditem's details vector
-				}
-
-				else if (word_lower.length() > 0 && myTree.find(word_lower) != nullptr) {  //word is not new
-					bool new_filename_save = true;  //but filename might be new
-					for (int y = 0; y < myTree.find(word_lower)->details.size(); y++) {
-						if (myTree.find(word_lower)->details[y].documentName == filenames[i]) {  //document with name filename is already checked, so the count should be incremented
-							new_filename_save = false;  //set from true to false
-							myTree.find(word_lower)->details[y].count += 1;
-							break;
-						}
-					}
-					if (new_filename_save) {  //new filename should be used to hold track
-						DocumentItem new_filename_item;
-						new_filename_item.documentName = filenames[i];
-						new_filename_item.count = 1;
-						myTree.find(word_lower)->details.push_back(new_filename_item);
-					}
-				}
-			}
-		}
-	}
-	cin.ignore();  //if this is not used and not used here, then the query input is taken wrongly (character or the whole input might be lost)
-	while (true) {
-		string search;
-		cout << "Enter queried words in one line: ";
-		getline(cin, search);
-
-		if (tolower_string(search.substr(0, 10)) == "endofinput") return 0;  //end of input
-
-		else if (tolower_string(search.substr(0, 6)) == "remove") {
-			myTree.remove(tolower_string(search.substr(7)));  //characters before index 7 are "remove" and the rest of string is to be removed
-			cout << search.substr(7) << " has been REMOVED\n";
-		}
-
-		else {
-			istringstream iss(search);
-			string substring;
-			vector<WordItem*> found_nodes = {};
-			bool all_words_found = true;
-			while (iss >> substring) {  //reading the search input word by word
-				if (myTree.find(tolower_string(substring)) == nullptr) {  //all words in query are not found, so given query is not found
-					all_words_found = false;
-					cout << "No document contains the given query\n";
-					break;
-				}
-				else {
-					found_nodes.push_back(myTree.find(substring));  //nodes of found words are pushed into found_nodes vector
-				}
-			}
-
-			if (all_words_found == true) {  //given query is found
-
-				//3D for loop is for this: For each filename, every found word should be printed with their counts.
-				for (int i = 0; i < filenames.size(); i++) {  //for each filename
-					bool document_printed = false; //this is just for formatting the commas and dots
-					for (int y = 0; y < found_nodes.size(); y++) {   //every found word
-						for (int z = 0; z < found_nodes[y]->details.size(); z++) {    //should be printed with their counts
-							if (filenames[i] == found_nodes[y]->details[z].documentName) {
-								if (document_printed) {
-									cout << ", ";
-								}
-								else {
-									cout << "in Document " << filenames[i] << ", ";  //initialization of sentence
-									document_printed = true;
-								}
-								cout << found_nodes[y]->word << " found " << found_nodes[y]->details[z].count << " times";
-							}
-						}
-					}
-					if (document_printed) { //end for a particular filename
-						cout << ".\n";
-					}
-				}
-			}
-		}
-		cout << "\n";
-	}
-
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <shared_mutex>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <unordered_map>
+#include <list>
+#include <cstdint>
+
+using namespace std;
+
+struct DocumentItem {  //one posting, documents are referred to by their id in DocumentTable
+	uint32_t documentId;
+	int count;
+};
+
+class DocumentTable {  //gives every document name a dense id in order of first appearance
+public:
+	uint32_t getId(const string& name) {
+		unordered_map<string, uint32_t>::iterator it = ids.find(name);
+		if (it != ids.end()) return it->second;
+		uint32_t id = names.size();
+		ids[name] = id;
+		names.push_back(name);
+		return id;
+	}
+
+	const string& name(uint32_t id) const {
+		return names[id];
+	}
+
+private:
+	vector<string> names;
+	unordered_map<string, uint32_t> ids;
+};
+
+void addPosting(vector<DocumentItem>& details, uint32_t documentId, int count) {
+	//postings stay sorted by id, files come in id order so this is almost always the last entry
+	if (!details.empty() && details.back().documentId == documentId) {
+		details.back().count += count;
+	}
+	else if (details.empty() || details.back().documentId < documentId) {
+		DocumentItem new_save;
+		new_save.documentId = documentId;
+		new_save.count = count;
+		details.push_back(new_save);
+	}
+	else {  //a file given twice comes back with an older id
+		size_t low = 0, high = details.size();
+		while (low < high) {
+			size_t mid = (low + high) / 2;
+			if (details[mid].documentId < documentId) low = mid + 1;
+			else high = mid;
+		}
+		if (low < details.size() && details[low].documentId == documentId) {
+			details[low].count += count;
+		}
+		else {
+			DocumentItem new_save;
+			new_save.documentId = documentId;
+			new_save.count = count;
+			details.insert(details.begin() + low, new_save);
+		}
+	}
+}
+
+int findPosting(const vector<DocumentItem>& details, uint32_t documentId) {  //count of the document, 0 if the word is not in it
+	size_t low = 0, high = details.size();
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (details[mid].documentId < documentId) low = mid + 1;
+		else high = mid;
+	}
+	if (low < details.size() && details[low].documentId == documentId) return details[low].count;
+	return 0;
+}
+
+struct WordItem {  //node structure
+	string word;
+	WordItem* left = nullptr;
+	WordItem* right = nullptr;
+	vector <DocumentItem> details = {};
+	int height;
+
+	WordItem(string word, WordItem* left = nullptr, WordItem* right = nullptr, int height = 0) :
+		word(std::move(word)), left(left), right(right), height(height), details({}) {}
+
+
+};
+
+string tolower_string(string s);
+
+string tolower_string(string s) {  //embedded tolower function is used for chars so I defined a function to obtain lowercase strings
+	string last_string = "";
+	for (size_t i = 0; i < s.length(); i++) {
+		if ((s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z')) last_string += tolower(s[i]);
+		else {  //there are invalid characters (non alphabetical)
+			last_string = "";
+			break;
+		}
+	}
+	return last_string;
+}
+
+string_view lowerKey(string_view key, string& buffer) {  //the key itself if it has no upper case letters, otherwise a lowered copy in buffer (short words need no allocation)
+	for (size_t i = 0; i < key.size(); i++) {
+		if (key[i] >= 'A' && key[i] <= 'Z') {
+			buffer.assign(key.data(), key.size());
+			for (size_t j = i; j < buffer.size(); j++) buffer[j] = tolower(buffer[j]);
+			return buffer;
+		}
+	}
+	return key;
+}
+
+
+template <class Node>
+class NewDeleteAllocator {  //node allocation policy of AVLSearchTree, one heap allocation per node
+public:
+	template <class... Args>
+	Node* create(Args&&... args) {
+		return new Node(std::forward<Args>(args)...);
+	}
+
+	void destroy(Node* node) {
+		delete node;
+	}
+
+	void release() {}  //called once the tree is emptied
+
+	static constexpr bool RELEASES_NODES = false;  //nodes left alive would leak, the tree destroys each one
+};
+
+template <class Node>
+class ArenaAllocator {  //nodes come from slabs that double in size, released together instead of one by one
+public:
+	ArenaAllocator() = default;
+	ArenaAllocator(const ArenaAllocator&) = delete;
+	ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+	template <class... Args>
+	Node* create(Args&&... args) {
+		Slot* slot = freeList;
+		if (slot != nullptr) {  //reuse a removed node first
+			freeList = slot->next;
+		}
+		else {
+			if (used == slabSize) grow();
+			slot = &slabs.back()[used++];
+		}
+		return new (slot->storage) Node(std::forward<Args>(args)...);
+	}
+
+	void destroy(Node* node) {
+		node->~Node();
+		Slot* slot = reinterpret_cast<Slot*>(node);
+		slot->next = freeList;
+		freeList = slot;
+	}
+
+	void release() {  //hands back every slab, nodes never destroyed go with them
+		slabs.clear();
+		slabSize = used = 0;
+		freeList = nullptr;
+	}
+
+	static constexpr bool RELEASES_NODES = true;  //a tree of nodes without destructors skips destroying them one by one
+
+private:
+	union Slot {  //a live node or a link in the free list
+		Slot* next;
+		alignas(Node) unsigned char storage[sizeof(Node)];
+	};
+
+	static constexpr size_t FIRST_SLAB = 64;
+	static constexpr size_t LARGEST_SLAB = 16384;
+
+	void grow() {
+		slabSize = slabSize == 0 ? FIRST_SLAB : min(2 * slabSize, LARGEST_SLAB);
+		slabs.emplace_back(new Slot[slabSize]);
+		used = 0;
+	}
+
+	vector<unique_ptr<Slot[]>> slabs;
+	size_t slabSize = 0;
+	size_t used = 0;
+	Slot* freeList = nullptr;
+};
+
+
+template <class Key, class Value, class Allocator = ArenaAllocator<typename remove_pointer<Value>::type>>
+class AVLSearchTree
+{
+public:
+	AVLSearchTree();   //mostly taken from slides
+	~AVLSearchTree();
+	void insert(string_view key);
+	Value upsert(string_view key);  //find or insert in one descent
+	void remove(string_view key);
+	Value find(string_view key) const;
+	Value findMin() const;
+	void makeEmpty();
+	bool isEmpty();
+	int getBalance(Value& ptr) const;
+	template <class Visitor>
+	void forEach(Visitor visit) const;  //in order traversal
+	template <class RandomIt>
+	void bulkLoad(RandomIt first, RandomIt last);  //balanced tree from entries sorted by word, in linear time
+
+	void rotateWithLeftChild(Value& k2) const;
+	void rotateWithRightChild(Value& k1) const;
+	void doubleWithLeftChild(Value& k3) const;
+	void doubleWithRightChild(Value& k1) const;
+
+
+private:  //used for default arguments
+	static const int MAX_HEIGHT = 64;  //an AVL tree this tall would not fit in memory
+	Value root = nullptr;  
+	Allocator nodes;
+	void rebalance(Value* path[], int depth) const;
+	template <class RandomIt>
+	Value build(RandomIt first, RandomIt last);
+	void makeEmpty(Value& ptr);
+	Value findMin(Value ptr) const;
+	int getHeight(Value ptr) const;
+	template <class Visitor>
+	void forEach(Value ptr, Visitor& visit) const;
+};
+
+template <class Key, class Value, class Allocator>
+AVLSearchTree<Key, Value, Allocator>::AVLSearchTree() {   //constructor
+	root = nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+AVLSearchTree<Key, Value, Allocator>::~AVLSearchTree() {  //destructor
+	makeEmpty();
+}
+
+template<class Key, class Value, class Allocator>
+int AVLSearchTree<Key, Value, Allocator>::getHeight(Value ptr) const   //it is used to handle nullptr->height case
+{
+	if (ptr == nullptr) return -1;  //a leaf has height 0
+	else return ptr->height;
+}
+
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::makeEmpty() {   //root ptr is given default
+	if (!Allocator::RELEASES_NODES || !is_trivially_destructible<typename remove_pointer<Value>::type>::value) makeEmpty(root);  //WordItem owns its word and postings, so it is still walked
+	root = nullptr;
+	nodes.release();  //slabs go back at once
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::makeEmpty(Value& ptr) {
+	if (ptr != nullptr) {
+		makeEmpty(ptr->left);  //recursively deleting the nodes
+		makeEmpty(ptr->right);
+		nodes.destroy(ptr);
+	}
+	ptr = nullptr;
+}
+
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::insert(string_view key) {
+	upsert(key);
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::upsert(string_view key) {  //key must be lower case already, returns the node of key, new or old
+	Value* path[MAX_HEIGHT];  //links followed from the root, used for rebalancing on the way back
+	int depth = 0;
+	Value* link = &root;
+	while (*link != nullptr) {
+		int order = key.compare((*link)->word);  //one comparison per level
+		if (order == 0) return *link;  //found, nothing changes
+		path[depth++] = link;
+		link = order < 0 ? &(*link)->left : &(*link)->right;
+	}
+	Value node = nodes.create(Key(key));  //key was missing, it becomes a leaf
+	*link = node;
+	rebalance(path, depth);
+	return node;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::remove(string_view key) {
+	string buffer;
+	key = lowerKey(key, buffer);
+	Value* path[MAX_HEIGHT];
+	int depth = 0;
+	Value* link = &root;
+	while (*link != nullptr) {
+		int order = key.compare((*link)->word);
+		if (order == 0) break;
+		path[depth++] = link;
+		link = order < 0 ? &(*link)->left : &(*link)->right;
+	}
+	Value node = *link;
+	if (node == nullptr) return;  //nothing to remove
+
+	if (node->left != nullptr && node->right != nullptr) {  //two children, the successor's word and postings move up and the successor is unlinked instead
+		path[depth++] = link;
+		Value* successorLink = &node->right;
+		while ((*successorLink)->left != nullptr) {
+			path[depth++] = successorLink;
+			successorLink = &(*successorLink)->left;
+		}
+		Value successor = *successorLink;
+		node->word = std::move(successor->word);
+		node->details = std::move(successor->details);
+		*successorLink = successor->right;
+		nodes.destroy(successor);
+	}
+	else {  //zero or one child takes the node's place
+		*link = (node->left != nullptr) ? node->left : node->right;
+		nodes.destroy(node);
+	}
+	rebalance(path, depth);
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rebalance(Value* path[], int depth) const {  //from the deepest link up to the root
+	for (int i = depth; i-- > 0;) {
+		Value& ptr = *path[i];
+		int oldHeight = ptr->height;
+		ptr->height = max(getHeight(ptr->left), getHeight(ptr->right)) + 1;
+		int balance = getBalance(ptr);
+
+		if (balance > 1) {  //left side is two taller
+			if (getBalance(ptr->left) >= 0) rotateWithLeftChild(ptr);
+			else doubleWithLeftChild(ptr);
+		}
+		else if (balance < -1) {  //right side is two taller
+			if (getBalance(ptr->right) <= 0) rotateWithRightChild(ptr);
+			else doubleWithRightChild(ptr);
+		}
+		if (ptr->height == oldHeight) break;  //subtree kept its height, nothing above changes
+	}
+}
+
+
+template<class Key, class Value, class Allocator>
+int AVLSearchTree<Key, Value, Allocator>::getBalance(Value& ptr) const {
+	if (ptr == nullptr) return 0;   //handling ptr = nullptr case
+	return getHeight(ptr->left) - getHeight(ptr->right);
+}
+
+
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::find(string_view key) const
+{  //lowered once here, then an iterative descent without copies
+	string buffer;
+	key = lowerKey(key, buffer);
+	Value ptr = root;
+	while (ptr != nullptr) {
+		int order = key.compare(ptr->word);
+		if (order == 0) return ptr;  //found the word
+		ptr = order < 0 ? ptr->left : ptr->right;
+	}
+	return nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::findMin() const
+{
+	return findMin(root);
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::findMin(Value ptr) const
+{  //recursion again, but checks left only as order is from left to right
+	if (ptr == nullptr) return nullptr;
+	else if (ptr->left == nullptr) return ptr;
+	else return findMin(ptr->left);
+}
+
+
+
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+void AVLSearchTree<Key, Value, Allocator>::forEach(Visitor visit) const
+{  //root ptr is given default
+	forEach(root, visit);
+}
+
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+void AVLSearchTree<Key, Value, Allocator>::forEach(Value ptr, Visitor& visit) const
+{  //left subtree, node, right subtree so words come out alphabetically
+	if (ptr == nullptr) return;
+	forEach(ptr->left, visit);
+	visit(ptr);
+	forEach(ptr->right, visit);
+}
+
+template<class Key, class Value, class Allocator>
+template<class RandomIt>
+void AVLSearchTree<Key, Value, Allocator>::bulkLoad(RandomIt first, RandomIt last)
+{  //replaces the contents, words and postings are moved out of the entries, which must be sorted without duplicates
+	makeEmpty();
+	root = build(first, last);
+}
+
+template<class Key, class Value, class Allocator>
+template<class RandomIt>
+Value AVLSearchTree<Key, Value, Allocator>::build(RandomIt first, RandomIt last)
+{  //the middle entry becomes the root of the range, nothing is compared or rotated
+	if (first == last) return nullptr;
+	RandomIt middle = first + (last - first) / 2;
+	Value left = build(first, middle);  //left side first so the entries are read front to back
+	Value node = nodes.create(std::move(middle->word), left);
+	node->details = std::move(middle->details);
+	node->right = build(middle + 1, last);
+	node->height = max(getHeight(node->left), getHeight(node->right)) + 1;
+	return node;
+}
+
+template <class Key, class Value, class Allocator>
+bool AVLSearchTree<Key, Value, Allocator>::isEmpty() {
+	return (root == nullptr); //if root is null, then there is no node
+}
+
+
+//rotation and doubling graphs in slides are used in doubling and rotating
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rotateWithLeftChild(Value& k2) const {
+	if (k2 == nullptr || k2->left == nullptr) {
+		// Cannot perform rotation, k2 is nullptr or k2->left is nullptr
+		return;
+	}
+
+	
+	Value k1 = k2->left;
+	k2->left = k1->right;
+	k1->right = k2;
+	k2->height = max(getHeight(k2->left), getHeight(k2->right)) + 1;
+	k1->height = max(getHeight(k1->left), getHeight(k2)) + 1;
+	k2 = k1;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rotateWithRightChild(Value& k1) const {
+	if (k1 == nullptr || k1->right == nullptr) {
+		// Cannot perform rotation, k1 is nullptr or k1->right is nullptr
+		return;
+	}
+
+	Value k2 = k1->right;
+	k1->right = k2->left;
+	k2->left = k1;
+	k1->height = max(getHeight(k1->left), getHeight(k1->right)) + 1;
+	k2->height = max(getHeight(k2->right), getHeight(k1)) + 1;
+	k1 = k2;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::doubleWithLeftChild(Value& k3) const {  //left child is right heavy
+	if (k3 == nullptr || k3->left == nullptr) {
+		// Cannot perform double rotation, k3 is nullptr or k3->left is nullptr
+		return;
+	}
+
+	rotateWithRightChild(k3->left);
+	rotateWithLeftChild(k3);
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::doubleWithRightChild(Value& k1) const {  //right child is left heavy
+	if (k1 == nullptr || k1->right == nullptr) {
+		// Cannot perform double rotation, k1 is nullptr or k1->right is nullptr
+		return;
+	}
+
+	rotateWithLeftChild(k1->right);
+	rotateWithRightChild(k1);
+}
+
+
+
+
+
+struct WordEntry {  //payload of a snapshot node, shared by every version that still holds the word unchanged
+	string word;
+	vector<DocumentItem> details;
+};
+
+struct SnapshotNode {  //never changed once published, updates build new nodes instead
+	shared_ptr<const WordEntry> entry;
+	const SnapshotNode* left;
+	const SnapshotNode* right;
+	int height;
+};
+
+class SnapshotTree {  //AVL tree with path copying: readers pin a version and walk it without locks while a writer publishes new roots
+public:
+	static constexpr int MAX_READERS = 64;
+
+	class Snapshot {  //pins the current version until it goes out of scope, one at a time per reader slot
+	public:
+		Snapshot(SnapshotTree& tree, int reader) : slot(tree.readers[reader].epoch) {
+			slot.store(tree.globalEpoch.load());  //announced before the root is read, so nothing reachable from it is freed
+			root = tree.root.load();
+		}
+
+		~Snapshot() {
+			slot.store(IDLE);
+		}
+
+		const WordEntry* find(string_view key) const {
+			string buffer;
+			key = lowerKey(key, buffer);
+			const SnapshotNode* ptr = root;
+			while (ptr != nullptr) {
+				int order = key.compare(ptr->entry->word);
+				if (order == 0) return ptr->entry.get();
+				ptr = order < 0 ? ptr->left : ptr->right;
+			}
+			return nullptr;
+		}
+
+	private:
+		atomic<uint64_t>& slot;
+		const SnapshotNode* root;
+	};
+
+	SnapshotTree() {
+		for (int i = 0; i < MAX_READERS; i++) {
+			readers[i].epoch.store(IDLE);
+			readers[i].claimed.store(false);
+		}
+	}
+
+	~SnapshotTree() {  //no reader may be pinned any more
+		destroy(root.load());
+		for (size_t i = 0; i < retired.size(); i++) {
+			for (size_t j = 0; j < retired[i].nodes.size(); j++) delete retired[i].nodes[j];
+		}
+	}
+
+	int registerReader() {  //returns the slot a reading thread passes to Snapshot, -1 if all are taken
+		for (int i = 0; i < MAX_READERS; i++) {
+			bool expected = false;
+			if (readers[i].claimed.compare_exchange_strong(expected, true)) return i;
+		}
+		return -1;
+	}
+
+	void unregisterReader(int reader) {
+		readers[reader].claimed.store(false);
+	}
+
+	template <class Tree>
+	void load(const Tree& tree) {  //replaces the contents with a balanced copy of tree, built bottom up from its sorted words
+		vector<const WordItem*> items;
+		tree.forEach([&items](const WordItem* item) { items.push_back(item); });
+		lock_guard<mutex> lock(writerLock);
+		vector<const SnapshotNode*> replaced;
+		collect(root.load(), replaced);
+		publish(build(items, 0, items.size()), replaced);
+	}
+
+	void upsert(const string& word, uint32_t documentId, int count) {  //word must be lower case already
+		lock_guard<mutex> lock(writerLock);
+		vector<const SnapshotNode*> replaced;
+		publish(upsert(root.load(), word, documentId, count, replaced), replaced);
+	}
+
+	void remove(string_view key) {
+		string buffer;
+		key = lowerKey(key, buffer);
+		lock_guard<mutex> lock(writerLock);  //the writer only walks versions it published itself, so it needs no pin
+		const SnapshotNode* top = root.load();
+		if (!contains(top, key)) return;  //nothing to copy
+		vector<const SnapshotNode*> replaced;
+		publish(remove(top, key, replaced), replaced);
+	}
+
+private:
+	static const uint64_t IDLE = UINT64_MAX;
+	static const size_t MAX_RETIRED = 1 << 16;  //replaced nodes kept for pinned readers before a writer waits, so a thread must not write while it holds a Snapshot
+
+	struct alignas(64) ReaderSlot {  //one cache line each so readers do not share lines
+		atomic<uint64_t> epoch;
+		atomic<bool> claimed;
+	};
+
+	struct RetiredNodes {  //replaced while globalEpoch was epoch, freed once every reader moved past it
+		uint64_t epoch;
+		vector<const SnapshotNode*> nodes;
+	};
+
+	ReaderSlot readers[MAX_READERS];
+	atomic<uint64_t> globalEpoch{ 1 };
+	atomic<const SnapshotNode*> root{ nullptr };
+	mutex writerLock;  //one writer at a time, readers never take it
+	vector<RetiredNodes> retired;
+	size_t retiredCount = 0;  //nodes in retired
+
+	static int height(const SnapshotNode* ptr) {
+		return ptr == nullptr ? -1 : ptr->height;
+	}
+
+	static const SnapshotNode* makeNode(shared_ptr<const WordEntry> entry, const SnapshotNode* left, const SnapshotNode* right) {
+		return new SnapshotNode{ move(entry), left, right, max(height(left), height(right)) + 1 };
+	}
+
+	static bool contains(const SnapshotNode* ptr, string_view key) {
+		while (ptr != nullptr) {
+			int order = key.compare(ptr->entry->word);
+			if (order == 0) return true;
+			ptr = order < 0 ? ptr->left : ptr->right;
+		}
+		return false;
+	}
+
+	//new node over left and right, rotated if one side is two taller; rotated nodes are copied and the old ones replaced
+	static const SnapshotNode* join(const shared_ptr<const WordEntry>& entry, const SnapshotNode* left, const SnapshotNode* right, vector<const SnapshotNode*>& replaced) {
+		if (height(left) > height(right) + 1) {
+			replaced.push_back(left);
+			if (height(left->left) >= height(left->right)) {  //single rotation with the left child
+				return makeNode(left->entry, left->left, makeNode(entry, left->right, right));
+			}
+			const SnapshotNode* middle = left->right;  //double rotation, the left child's right child comes up
+			replaced.push_back(middle);
+			return makeNode(middle->entry, makeNode(left->entry, left->left, middle->left), makeNode(entry, middle->right, right));
+		}
+		if (height(right) > height(left) + 1) {  //mirror image
+			replaced.push_back(right);
+			if (height(right->right) >= height(right->left)) {
+				return makeNode(right->entry, makeNode(entry, left, right->left), right->right);
+			}
+			const SnapshotNode* middle = right->left;
+			replaced.push_back(middle);
+			return makeNode(middle->entry, makeNode(entry, left, middle->left), makeNode(right->entry, middle->right, right->right));
+		}
+		return makeNode(entry, left, right);
+	}
+
+	static const SnapshotNode* upsert(const SnapshotNode* ptr, const string& word, uint32_t documentId, int count, vector<const SnapshotNode*>& replaced) {
+		if (ptr == nullptr) {
+			shared_ptr<WordEntry> entry = make_shared<WordEntry>();
+			entry->word = word;
+			addPosting(entry->details, documentId, count);
+			return makeNode(move(entry), nullptr, nullptr);
+		}
+		replaced.push_back(ptr);  //every node on the path is copied
+		int order = word.compare(ptr->entry->word);
+		if (order == 0) {
+			shared_ptr<WordEntry> entry = make_shared<WordEntry>(*ptr->entry);  //postings are copied once per update of the word
+			addPosting(entry->details, documentId, count);
+			return makeNode(move(entry), ptr->left, ptr->right);
+		}
+		if (order < 0) return join(ptr->entry, upsert(ptr->left, word, documentId, count, replaced), ptr->right, replaced);
+		return join(ptr->entry, ptr->left, upsert(ptr->right, word, documentId, count, replaced), replaced);
+	}
+
+	static const SnapshotNode* removeMin(const SnapshotNode* ptr, vector<const SnapshotNode*>& replaced) {
+		replaced.push_back(ptr);
+		if (ptr->left == nullptr) return ptr->right;
+		return join(ptr->entry, removeMin(ptr->left, replaced), ptr->right, replaced);
+	}
+
+	static const SnapshotNode* remove(const SnapshotNode* ptr, string_view key, vector<const SnapshotNode*>& replaced) {  //key must be in the tree
+		replaced.push_back(ptr);
+		int order = key.compare(ptr->entry->word);
+		if (order < 0) return join(ptr->entry, remove(ptr->left, key, replaced), ptr->right, replaced);
+		if (order > 0) return join(ptr->entry, ptr->left, remove(ptr->right, key, replaced), replaced);
+		if (ptr->left == nullptr) return ptr->right;
+		if (ptr->right == nullptr) return ptr->left;
+		const SnapshotNode* successor = ptr->right;  //two children, the successor's entry takes the node's place
+		while (successor->left != nullptr) successor = successor->left;
+		return join(successor->entry, ptr->left, removeMin(ptr->right, replaced), replaced);
+	}
+
+	static const SnapshotNode* build(const vector<const WordItem*>& items, int low, int high) {  //balanced tree over items[low, high)
+		if (low >= high) return nullptr;
+		int mid = (low + high) / 2;
+		shared_ptr<WordEntry> entry = make_shared<WordEntry>();
+		entry->word = items[mid]->word;
+		entry->details = items[mid]->details;
+		const SnapshotNode* left = build(items, low, mid);
+		const SnapshotNode* right = build(items, mid + 1, high);
+		return makeNode(move(entry), left, right);
+	}
+
+	static void collect(const SnapshotNode* ptr, vector<const SnapshotNode*>& nodes) {
+		if (ptr == nullptr) return;
+		collect(ptr->left, nodes);
+		collect(ptr->right, nodes);
+		nodes.push_back(ptr);
+	}
+
+	static void destroy(const SnapshotNode* ptr) {
+		if (ptr == nullptr) return;
+		destroy(ptr->left);
+		destroy(ptr->right);
+		delete ptr;
+	}
+
+	void publish(const SnapshotNode* newRoot, vector<const SnapshotNode*>& replaced) {  //writerLock is held
+		root.store(newRoot);
+		//readers that announced this epoch or an older one may still be walking the replaced nodes
+		retiredCount += replaced.size();
+		retired.push_back({ globalEpoch.fetch_add(1), move(replaced) });
+		reclaim();
+		while (retiredCount > MAX_RETIRED) {  //a reader that stays pinned would let the list grow without bound, the writer waits for it instead
+			this_thread::yield();
+			reclaim();
+		}
+	}
+
+	void reclaim() {  //frees the nodes no pinned reader can reach any more
+		uint64_t oldest = IDLE;
+		for (int i = 0; i < MAX_READERS; i++) oldest = min(oldest, readers[i].epoch.load());
+		size_t freed = 0;
+		while (freed < retired.size() && retired[freed].epoch < oldest) {
+			for (size_t j = 0; j < retired[freed].nodes.size(); j++) delete retired[freed].nodes[j];
+			retiredCount -= retired[freed].nodes.size();
+			freed++;
+		}
+		retired.erase(retired.begin(), retired.begin() + freed);
+	}
+};
+
+
+bool indexFile(const string& filename, uint32_t documentId, AVLSearchTree<string, WordItem*>& myTree) {  //returns false if the file could not be opened
+	ifstream file(filename);
+	if (!file.is_open()) return false;
+
+	string word, word_lower;
+	while (file >> word) { //starting to build the tree
+		word_lower = tolower_string(word);  //tolower again
+		if (word_lower.length() > 0) {  //non alphabeticals are already eliminated
+			addPosting(myTree.upsert(word_lower)->details, documentId, 1);  //count of this document is incremented or it is added at the end
+		}
+	}
+	return true;
+}
+
+void ingestFiles(const vector<string>& filenames, DocumentTable& documents, AVLSearchTree<string, WordItem*>& myTree, int threadCount) {
+	vector<uint32_t> documentIds;  //ids are given before the workers start so all shards use the same ones
+	for (size_t i = 0; i < filenames.size(); i++) documentIds.push_back(documents.getId(filenames[i]));
+
+	int workerCount = min<int>(threadCount, filenames.size());
+	if (workerCount <= 1) {  //serial build, one file after another
+		for (size_t i = 0; i < filenames.size(); i++) {
+			if (!indexFile(filenames[i], documentIds[i], myTree)) {  //wrong filename or missing file
+				cout << filenames[i] << " could not be opened!\n";
+			}
+		}
+		return;
+	}
+
+	//every worker builds a private tree from a contiguous run of files
+	vector<unique_ptr<AVLSearchTree<string, WordItem*>>> shards;
+	vector<char> opened(filenames.size(), 0);
+	vector<thread> workers;
+	for (int w = 0; w < workerCount; w++) shards.emplace_back(new AVLSearchTree<string, WordItem*>());
+	for (int w = 0; w < workerCount; w++) {
+		workers.emplace_back([&, w]() {
+			int first = filenames.size() * w / workerCount;
+			int last = filenames.size() * (w + 1) / workerCount;
+			for (int i = first; i < last; i++) opened[i] = indexFile(filenames[i], documentIds[i], *shards[w]);
+		});
+	}
+	for (int w = 0; w < workerCount; w++) workers[w].join();
+
+	for (size_t i = 0; i < filenames.size(); i++) {
+		if (!opened[i]) cout << filenames[i] << " could not be opened!\n";  //same messages and order as the serial build
+	}
+
+	vector<vector<WordEntry>> vocabularies(workerCount);  //every shard's words in order, postings are moved out
+	for (int w = 0; w < workerCount; w++) {
+		shards[w]->forEach([&](WordItem* node) { vocabularies[w].push_back({ node->word, std::move(node->details) }); });
+		shards[w].reset();
+	}
+
+	//the shards' sorted words are merged side by side; later shards hold later files, so postings
+	//appended shard by shard keep documents in the serial order, and the sorted result is bulk loaded
+	vector<WordEntry> merged;
+	vector<size_t> heads(workerCount, 0);
+	while (true) {
+		const string* smallest = nullptr;
+		for (int w = 0; w < workerCount; w++) {
+			if (heads[w] < vocabularies[w].size() && (smallest == nullptr || vocabularies[w][heads[w]].word < *smallest)) smallest = &vocabularies[w][heads[w]].word;
+		}
+		if (smallest == nullptr) break;  //every shard is used up
+
+		WordEntry entry;
+		entry.word = *smallest;
+		for (int w = 0; w < workerCount; w++) {
+			if (heads[w] == vocabularies[w].size() || vocabularies[w][heads[w]].word != entry.word) continue;
+			const vector<DocumentItem>& details = vocabularies[w][heads[w]].details;
+			for (size_t z = 0; z < details.size(); z++) addPosting(entry.details, details[z].documentId, details[z].count);  //a file given twice is summed as in the serial build
+			heads[w]++;
+		}
+		merged.push_back(std::move(entry));
+	}
+	myTree.bulkLoad(merged.begin(), merged.end());
+}
+
+
+string syntheticWord(int n) {  //distinct lowercase word for every n, for the benchmarks
+	string word;
+	do {
+		word += char('a' + n % 26);
+		n /= 26;
+	} while (n > 0);
+	return word;
+}
+
+template <class Read, class Update>
+void benchReaders(const string& label, int readerCount, const vector<string>& words, Read read, Update update) {  //readers look up random words for a while, one writer keeps updating
+	atomic<bool> running(true);
+	atomic<long long> lookups(0);
+	long long updates = 0;
+	vector<thread> threads;
+	for (int r = 0; r < readerCount; r++) {
+		threads.emplace_back([&, r]() {
+			mt19937 random(r + 1);
+			long long done = 0;
+			volatile int found = 0;  //keeps the lookups from being optimized away
+			while (running.load(memory_order_relaxed)) {
+				for (int i = 0; i < 256; i++, done++) found = found + read(r, words[random() % words.size()]);
+			}
+			lookups += done;
+		});
+	}
+	thread writer([&]() {
+		mt19937 random(0);
+		while (running.load(memory_order_relaxed)) {
+			update(words[random() % words.size()]);
+			updates++;
+		}
+	});
+	this_thread::sleep_for(chrono::milliseconds(500));
+	running = false;
+	for (int r = 0; r < readerCount; r++) threads[r].join();
+	writer.join();
+	cout << label << ", " << readerCount << " readers: " << lookups / 0.5 / 1e6 << " million lookups/s, "
+		<< updates / 0.5 << " updates/s\n";
+}
+
+int benchSnapshots(int maxReaders) {  //snapshot readers against readers sharing a lock with the writer
+	vector<string> words;
+	for (int i = 0; i < 200000; i++) words.push_back(syntheticWord(i));
+	AVLSearchTree<string, WordItem*> source;
+	for (size_t i = 0; i < words.size(); i++) addPosting(source.upsert(words[i])->details, 0, 1);
+	cout << words.size() << " words, the writer removes a word and puts it back on every update, "
+		<< thread::hardware_concurrency() << " hardware threads\n";
+
+	for (int readers = 1; readers <= maxReaders; readers *= 2) {
+		SnapshotTree snapshots;
+		snapshots.load(source);
+		vector<int> slots;
+		for (int r = 0; r < readers; r++) slots.push_back(snapshots.registerReader());
+		benchReaders("snapshots", readers, words,
+			[&](int r, const string& word) { SnapshotTree::Snapshot snapshot(snapshots, slots[r]); return snapshot.find(word) != nullptr; },
+			[&](const string& word) { snapshots.remove(word); snapshots.upsert(word, 0, 1); });
+
+		AVLSearchTree<string, WordItem*> tree;
+		for (size_t i = 0; i < words.size(); i++) addPosting(tree.upsert(words[i])->details, 0, 1);
+		shared_mutex lock;
+		benchReaders("shared lock", readers, words,
+			[&](int, const string& word) { shared_lock<shared_mutex> guard(lock); return tree.find(word) != nullptr; },
+			[&](const string& word) { unique_lock<shared_mutex> guard(lock); tree.remove(word); addPosting(tree.upsert(word)->details, 0, 1); });
+	}
+	return 0;
+}
+
+struct QueryAnswer {  //what the cache keeps for a query, counts[t][i] is the count of its t-th sorted word in the i-th file
+	bool all_words_found = false;
+	vector<vector<int>> counts;
+};
+
+class QueryCache {  //LRU cache of answers keyed on the sorted distinct words of a query, held under a byte budget
+public:
+	QueryCache(size_t byteBudget) : byteBudget(byteBudget) {}
+
+	static vector<string> queryWords(const string& search) {  //the lowercased words of the query in order
+		istringstream iss(search);
+		vector<string> words;
+		string substring;
+		while (iss >> substring) words.push_back(tolower_string(substring));
+		return words;
+	}
+
+	static vector<string> sortedTerms(vector<string> words) {  //order and repeats do not change an answer
+		sort(words.begin(), words.end());
+		words.erase(unique(words.begin(), words.end()), words.end());
+		return words;
+	}
+
+	static string keyOf(const vector<string>& terms) {
+		string key;
+		for (size_t i = 0; i < terms.size(); i++) key += (i == 0 ? "" : " ") + terms[i];
+		return key;
+	}
+
+	const QueryAnswer* find(const string& key) {  //a hit becomes the most recently used entry
+		unordered_map<string, list<Entry>::iterator>::iterator it = entries.find(key);
+		if (it == entries.end()) {
+			misses++;
+			return nullptr;
+		}
+		hits++;
+		order.splice(order.begin(), order, it->second);
+		return &it->second->answer;
+	}
+
+	void insert(const string& key, const vector<string>& terms, QueryAnswer answer) {  //least recently used entries go until the new one fits
+		size_t bytes = sizeof(Entry) + 2 * key.size() + 64;
+		for (size_t t = 0; t < terms.size(); t++) bytes += sizeof(string) + terms[t].size();
+		for (size_t t = 0; t < answer.counts.size(); t++) bytes += sizeof(vector<int>) + answer.counts[t].size() * sizeof(int);  //empty when a word is not found
+		if (bytes > byteBudget) return;  //larger than the whole cache
+		unordered_map<string, list<Entry>::iterator>::iterator existing = entries.find(key);
+		if (existing != entries.end()) erase(existing->second);
+
+		order.push_front({ key, terms, std::move(answer), bytes });
+		entries[key] = order.begin();
+		for (size_t t = 0; t < terms.size(); t++) termKeys[terms[t]].push_back(key);
+		usedBytes += bytes;
+		while (usedBytes > byteBudget) erase(prev(order.end()));
+	}
+
+	int invalidate(const string& word) {  //drops only the entries whose query has word, returns how many
+		unordered_map<string, vector<string>>::iterator it = termKeys.find(word);
+		if (it == termKeys.end()) return 0;
+		vector<string> keys = std::move(it->second);
+		termKeys.erase(it);
+		int dropped = 0;
+		for (size_t k = 0; k < keys.size(); k++) {
+			unordered_map<string, list<Entry>::iterator>::iterator entry = entries.find(keys[k]);
+			if (entry == entries.end()) continue;
+			erase(entry->second);
+			dropped++;
+		}
+		return dropped;
+	}
+
+	void recordLatency(bool hit, long long nanoseconds) {  //the latest LATENCY_SAMPLES times of hits and of misses are kept
+		vector<long long>& samples = hit ? hitLatencies : missLatencies;
+		size_t& next = hit ? nextHitSample : nextMissSample;
+		if (samples.size() < LATENCY_SAMPLES) samples.push_back(nanoseconds);
+		else samples[next] = nanoseconds;
+		next = (next + 1) % LATENCY_SAMPLES;
+	}
+
+	double hitRatio() const {
+		return hits + misses == 0 ? 0.0 : hits / double(hits + misses);
+	}
+
+	void printStats() const {
+		cout << "Query cache: " << entries.size() << " entries in " << usedBytes << " of " << byteBudget << " bytes, "
+			<< hits << " hits, " << misses << " misses, hit ratio " << hitRatio() << "\n";
+		printPercentiles("hits", hitLatencies);
+		printPercentiles("misses", missLatencies);
+	}
+
+private:
+	struct Entry {
+		string key;
+		vector<string> terms;
+		QueryAnswer answer;
+		size_t bytes;
+	};
+
+	static const size_t LATENCY_SAMPLES = 1 << 16;
+
+	size_t byteBudget;
+	size_t usedBytes = 0;
+	list<Entry> order;  //most recently used first
+	unordered_map<string, list<Entry>::iterator> entries;
+	unordered_map<string, vector<string>> termKeys;  //keys of the entries whose query has the word
+	size_t hits = 0, misses = 0;
+	vector<long long> hitLatencies, missLatencies;
+	size_t nextHitSample = 0, nextMissSample = 0;
+
+	void erase(list<Entry>::iterator entry) {
+		for (size_t t = 0; t < entry->terms.size(); t++) {  //the entry leaves the key lists of its words
+			unordered_map<string, vector<string>>::iterator it = termKeys.find(entry->terms[t]);
+			if (it == termKeys.end()) continue;
+			vector<string>& keys = it->second;
+			vector<string>::iterator key = std::find(keys.begin(), keys.end(), entry->key);
+			if (key != keys.end()) {
+				*key = std::move(keys.back());
+				keys.pop_back();
+			}
+			if (keys.empty()) termKeys.erase(it);
+		}
+		usedBytes -= entry->bytes;
+		entries.erase(entry->key);
+		order.erase(entry);
+	}
+
+	static void printPercentiles(const string& label, vector<long long> samples) {
+		if (samples.empty()) return;
+		sort(samples.begin(), samples.end());
+		cout << label << ": p50 " << samples[samples.size() / 2] << " ns, p99 " << samples[samples.size() - 1 - samples.size() / 100] << " ns\n";
+	}
+};
+
+template <class Lookup>
+QueryAnswer computeAnswer(const vector<string>& terms, Lookup lookup, const vector<uint32_t>& fileIds) {  //lookup(word) gives the node with word and details or nullptr, fileIds[i] is the document id of the i-th file
+	QueryAnswer answer;
+	vector<decltype(lookup(""))> found_nodes = {};
+	for (size_t t = 0; t < terms.size(); t++) {
+		found_nodes.push_back(lookup(terms[t]));
+		if (found_nodes.back() == nullptr) return answer;  //all words in query are not found, so given query is not found
+	}
+	answer.all_words_found = true;
+	answer.counts.assign(terms.size(), vector<int>(fileIds.size(), 0));
+	vector<int> countOf;  //count of the word by document id, so every posting is read once
+	for (size_t t = 0; t < terms.size(); t++) {
+		const vector<DocumentItem>& details = found_nodes[t]->details;
+		countOf.assign(fileIds.size(), 0);  //every document is one of the files
+		for (size_t z = 0; z < details.size(); z++) countOf[details[z].documentId] = details[z].count;
+		for (size_t i = 0; i < fileIds.size(); i++) answer.counts[t][i] = countOf[fileIds[i]];
+	}
+	return answer;
+}
+
+void printAnswer(const QueryAnswer& answer, const vector<string>& words, const vector<string>& terms, const vector<string>& filenames, ostream& out = cout) {  //words come out in query order
+	if (!answer.all_words_found) {
+		out << "No document contains the given query\n";
+		return;
+	}
+	vector<int> termOf(words.size());  //position of every query word among the sorted terms
+	for (size_t y = 0; y < words.size(); y++) termOf[y] = lower_bound(terms.begin(), terms.end(), words[y]) - terms.begin();
+
+	//for each filename, every found word should be printed with its count in that document
+	for (size_t i = 0; i < filenames.size(); i++) {  //for each filename
+		bool document_printed = false; //this is just for formatting the commas and dots
+		for (size_t y = 0; y < words.size(); y++) {   //every found word
+			int count = answer.counts[termOf[y]][i];
+			if (count > 0) {
+				if (document_printed) {
+					out << ", ";
+				}
+				else {
+					out << "in Document " << filenames[i] << ", ";  //initialization of sentence
+					document_printed = true;
+				}
+				out << words[y] << " found " << count << " times";
+			}
+		}
+		if (document_printed) { //end for a particular filename
+			out << ".\n";
+		}
+	}
+}
+
+template <class Lookup>
+void answerQuery(const string& search, Lookup lookup, const vector<string>& filenames, const vector<uint32_t>& fileIds, QueryCache& cache) {  //repeated word sets are answered from the cache
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	vector<string> words = QueryCache::queryWords(search);
+	vector<string> terms = QueryCache::sortedTerms(words);
+	string key = QueryCache::keyOf(terms);
+	const QueryAnswer* cached = cache.find(key);
+	QueryAnswer computed;
+	if (!cached) computed = computeAnswer(terms, lookup, fileIds);
+	cache.recordLatency(cached != nullptr, chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count());  //time to the answer, printing is left out
+	printAnswer(cached ? *cached : computed, words, terms, filenames);
+	if (!cached) cache.insert(key, terms, std::move(computed));
+}
+
+struct Command {  //one input line, parsed
+	enum Kind { QUERY, REMOVE, CACHE_STATS, END_OF_INPUT };
+	Kind kind;
+	string word;  //the word of a remove, as it was typed
+};
+
+Command parseCommand(const string& line) {  //the first word names the command in any case, every other line is a query
+	istringstream iss(line);
+	string first;
+	iss >> first;
+	first = tolower_string(first);
+	if (first == "endofinput") return { Command::END_OF_INPUT, "" };
+	if (first == "cachestats") return { Command::CACHE_STATS, "" };
+	if (first == "remove") {
+		string word;
+		getline(iss >> ws, word);
+		word.erase(word.find_last_not_of(" \t\r") + 1);  //trailing blanks are not part of the word
+		if (!word.empty()) return { Command::REMOVE, word };  //a bare "remove" is searched for like any word
+	}
+	return { Command::QUERY, "" };
+}
+
+struct ReaderAnswer {  //what a reader thread hands back for one query
+	string text;
+	QueryAnswer answer;
+	long long nanoseconds = 0;
+};
+
+class ReaderPool {  //threads that take queued tasks in order, each result comes back through the future of its task
+public:
+	explicit ReaderPool(int threadCount) {
+		for (int i = 0; i < threadCount; i++) threads.emplace_back([this]() { run(); });
+	}
+
+	~ReaderPool() {  //queued tasks still run before the threads end
+		{
+			lock_guard<mutex> lock(queueLock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	}
+
+	template <class Task>
+	future<ReaderAnswer> submit(Task task) {
+		packaged_task<ReaderAnswer()> packaged(std::move(task));
+		future<ReaderAnswer> result = packaged.get_future();
+		{
+			lock_guard<mutex> lock(queueLock);
+			tasks.push_back(std::move(packaged));
+		}
+		wake.notify_one();
+		return result;
+	}
+
+private:
+	vector<thread> threads;
+	deque<packaged_task<ReaderAnswer()>> tasks;
+	mutex queueLock;
+	condition_variable wake;
+	bool stopping = false;
+
+	void run() {
+		while (true) {
+			packaged_task<ReaderAnswer()> task;
+			{
+				unique_lock<mutex> lock(queueLock);
+				wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) return;  //stopping and nothing is left
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
+
+struct PendingOutput {  //one piece of the output of serveSnapshots, printed in input order
+	enum Kind { TEXT, ANSWER, CACHE_STATS, END };
+	Kind kind = TEXT;
+	string text;
+	future<ReaderAnswer> answer;  //a query the cache missed, answered on a reader
+	string key;
+	vector<string> terms;
+	size_t removedBefore = 0;  //removes read before the query
+	int slot = -1;  //reader slot its snapshot pinned
+};
+
+//Answers the queries of standard input from snapshots while removes keep publishing new versions. This thread reads
+//the lines and publishes a remove as soon as it is read; a query pins the version of the moment it is read, so it sees
+//the removes before it and none after, and is answered on one of readerCount threads while later lines are read.
+//A printer thread prints everything in input order. Answers are the ones of the serial loop, but a query read while
+//an equal one is still being answered is counted as a miss.
+int serveSnapshots(SnapshotTree& snapshots, const vector<string>& filenames, const vector<uint32_t>& fileIds, QueryCache& cache, int readerCount) {
+	ReaderPool readers(readerCount);
+	mutex stateLock;  //guards the cache, the free slots, the removed words and the outputs
+	condition_variable slotFreed, outputAdded;
+	deque<PendingOutput> outputs;
+	vector<int> freeSlots;  //one per query in flight
+	vector<string> removed;  //every removed word in input order
+	for (int i = 0; i < min(2 * readerCount, SnapshotTree::MAX_READERS); i++) freeSlots.push_back(snapshots.registerReader());
+
+	auto add = [&](PendingOutput output) {
+		{
+			lock_guard<mutex> lock(stateLock);
+			outputs.push_back(std::move(output));
+		}
+		outputAdded.notify_one();
+	};
+	auto text = [](const string& text) {
+		PendingOutput output;
+		output.text = text;
+		return output;
+	};
+
+	thread printer([&]() {
+		while (true) {
+			PendingOutput output;
+			{
+				unique_lock<mutex> lock(stateLock);
+				if (outputs.empty()) {  //everything so far is shown while the next line is awaited
+					lock.unlock();
+					cout.flush();
+					lock.lock();
+				}
+				outputAdded.wait(lock, [&]() { return !outputs.empty(); });
+				output = std::move(outputs.front());
+				outputs.pop_front();
+			}
+			if (output.kind == PendingOutput::END) return;
+			else if (output.kind == PendingOutput::TEXT) cout << output.text;
+			else if (output.kind == PendingOutput::CACHE_STATS) {
+				lock_guard<mutex> lock(stateLock);
+				cache.printStats();
+			}
+			else {
+				ReaderAnswer answer = output.answer.get();
+				cout << answer.text;
+				lock_guard<mutex> lock(stateLock);
+				cache.recordLatency(false, answer.nanoseconds);
+				bool stale = false;  //a word of the query was removed after it was read, the answer belongs to an older version
+				for (size_t r = output.removedBefore; r < removed.size(); r++) stale = stale || binary_search(output.terms.begin(), output.terms.end(), removed[r]);
+				if (!stale) cache.insert(output.key, output.terms, std::move(answer.answer));
+				freeSlots.push_back(output.slot);
+				slotFreed.notify_one();
+			}
+		}
+	});
+
+	cin.tie(nullptr);  //only the printer writes to cout
+	while (true) {
+		add(text("Enter queried words in one line: "));
+		string search;
+		if (!getline(cin, search)) break;  //input ended without endofinput
+		Command command = parseCommand(search);
+
+		if (command.kind == Command::END_OF_INPUT) break;
+
+		else if (command.kind == Command::REMOVE) {
+			string word = tolower_string(command.word);
+			snapshots.remove(word);  //readers keep walking the versions they pinned
+			{
+				lock_guard<mutex> lock(stateLock);
+				cache.invalidate(word);
+				removed.push_back(word);
+			}
+			add(text(command.word + " has been REMOVED\n"));
+		}
+
+		else if (command.kind == Command::CACHE_STATS) {
+			PendingOutput output;
+			output.kind = PendingOutput::CACHE_STATS;  //printed after the queries before it
+			add(std::move(output));
+		}
+
+		else {
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			vector<string> words = QueryCache::queryWords(search);
+			vector<string> terms = QueryCache::sortedTerms(words);
+			string key = QueryCache::keyOf(terms);
+			unique_lock<mutex> lock(stateLock);
+			const QueryAnswer* cached = cache.find(key);
+			if (cached) {
+				cache.recordLatency(true, chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count());
+				ostringstream out;
+				printAnswer(*cached, words, terms, filenames, out);
+				lock.unlock();
+				add(text(out.str()));
+			}
+			else {
+				slotFreed.wait(lock, [&]() { return !freeSlots.empty(); });  //as many queries in flight as there are slots
+				PendingOutput output;
+				output.kind = PendingOutput::ANSWER;
+				output.slot = freeSlots.back();
+				freeSlots.pop_back();
+				output.removedBefore = removed.size();
+				lock.unlock();
+
+				unique_ptr<SnapshotTree::Snapshot> snapshot(new SnapshotTree::Snapshot(snapshots, output.slot));  //pinned here, in input order
+				output.answer = readers.submit([&filenames, &fileIds, snapshot = std::move(snapshot), words, terms]() mutable {
+					ReaderAnswer result;
+					chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+					result.answer = computeAnswer(terms, [&snapshot](const string& word) { return snapshot->find(word); }, fileIds);
+					result.nanoseconds = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count();
+					snapshot.reset();  //unpinned before the future is ready, the slot is reused after that
+					ostringstream out;
+					printAnswer(result.answer, words, terms, filenames, out);
+					result.text = out.str();
+					return result;
+				});
+				output.key = std::move(key);
+				output.terms = std::move(terms);
+				add(std::move(output));
+			}
+		}
+		add(text("\n"));
+	}
+
+	PendingOutput end;
+	end.kind = PendingOutput::END;
+	add(std::move(end));
+	printer.join();
+	for (size_t i = 0; i < freeSlots.size(); i++) snapshots.unregisterReader(freeSlots[i]);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && string(argv[1]) == "--bench-snapshots") {
+		return benchSnapshots(argc > 2 ? stoi(argv[2]) : 8);
+	}
+
+	int threadCount = 1;  //--threads N builds the index with N workers
+	bool useSnapshots = false;  //--snapshots serves queries from copy-on-write versions of the tree
+	int readerCount = max(1, min<int>(thread::hardware_concurrency(), SnapshotTree::MAX_READERS / 2));  //--readers N answers snapshot queries on N threads
+	size_t cacheBytes = 16 << 20;  //--cache-bytes N bounds the query result cache, 0 turns it off
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--threads" && i + 1 < argc) threadCount = max(1, stoi(argv[++i]));
+		else if (string(argv[i]) == "--snapshots") useSnapshots = true;
+		else if (string(argv[i]) == "--readers" && i + 1 < argc) readerCount = max(1, min(stoi(argv[++i]), SnapshotTree::MAX_READERS / 2));
+		else if (string(argv[i]) == "--cache-bytes" && i + 1 < argc) cacheBytes = stoull(argv[++i]);
+	}
+
+	AVLSearchTree<string, WordItem*> myTree;
+	DocumentTable documents;
+	int fileNum;
+	cout << "Enter number of input files: ";
+	cin >> fileNum;
+	vector <string> filenames;
+	for (int i = 0; i < fileNum; i++) {
+		string new_filename;
+		cout << "Enter " << i + 1 << ". file name:";  //collecting filenames into the vector filenames
+		cin >> new_filename;
+		filenames.push_back(new_filename);
+	}
+
+	ingestFiles(filenames, documents, myTree, threadCount);
+	vector<uint32_t> fileIds;  //document id of every file, taken once so answering never changes the table
+	for (size_t i = 0; i < filenames.size(); i++) fileIds.push_back(documents.getId(filenames[i]));
+
+	QueryCache cache(cacheBytes);
+	cin.ignore();  //if this is not used and not used here, then the query input is taken wrongly (character or the whole input might be lost)
+	if (useSnapshots) {  //the tree is only read from here on, its contents move to the versioned copy
+		SnapshotTree snapshots;
+		snapshots.load(myTree);
+		myTree.makeEmpty();
+		return serveSnapshots(snapshots, filenames, fileIds, cache, readerCount);
+	}
+	while (true) {
+		string search;
+		cout << "Enter queried words in one line: ";
+		if (!getline(cin, search)) return 0;  //input ended without endofinput
+		Command command = parseCommand(search);
+
+		if (command.kind == Command::END_OF_INPUT) return 0;  //end of input
+
+		else if (command.kind == Command::REMOVE) {
+			myTree.remove(tolower_string(command.word));
+			cache.invalidate(tolower_string(command.word));  //answers of queries without the word stay
+			cout << command.word << " has been REMOVED\n";
+		}
+
+		else if (command.kind == Command::CACHE_STATS) cache.printStats();  //hit ratio and latencies so far
+
+		else {
+			answerQuery(search, [&myTree](const string& word) { return myTree.find(word); }, filenames, fileIds, cache);
+		}
+		cout << "\n";
+	}
+
 }
\ No newline at end of file
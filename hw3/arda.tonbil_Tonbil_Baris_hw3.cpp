@@ -1,572 +1,5660 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <sstream>
-#include <chrono>
-#include <cctype>
-#include <algorithm>
-#include <map>
-
-using namespace std;
-
-struct DocumentItem {
-    string documentName;
-    int count;
-};
-
-struct WordItem {
-    string word;
-    WordItem* left = nullptr;
-    WordItem* right = nullptr;
-    vector<DocumentItem> details = {};
-    int height;
-
-    WordItem(const string& word, WordItem* left = nullptr, WordItem* right = nullptr, int height = 0) :
-        word(word), left(left), right(right), height(height), details({}) {}
-};
-
-string tolower_string(string s) {
-    transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); });
-    return s;
-}
-
-template <class Key, class Value>
-class AVLSearchTree {
-public:
-    AVLSearchTree();
-    ~AVLSearchTree();
-    void insert(Key key);
-    void remove(Key key);
-    Value find(Key key) const;
-    Value findMin() const;
-    void makeEmpty();
-    bool isEmpty() const;
-    int getBalance(Value ptr) const;
-
-    void rotateWithLeftChild(Value& k2);
-    void rotateWithRightChild(Value& k1);
-    void doubleWithLeftChild(Value& k3);
-    void doubleWithRightChild(Value& k1);
-
-private:
-    Value root = nullptr;
-    void insert(Key key, Value& ptr);
-    void remove(Key key, Value& ptr);
-    void makeEmpty(Value& ptr);
-    Value find(Key key, Value ptr) const;
-    Value findMin(Value ptr) const;
-    int getHeight(Value ptr) const;
-};
-
-template <class Key, class Value>
-AVLSearchTree<Key, Value>::AVLSearchTree() {
-    root = nullptr;
-}
-
-template<class Key, class Value>
-AVLSearchTree<Key, Value>::~AVLSearchTree() {
-    makeEmpty();
-}
-
-template<class Key, class Value>
-int AVLSearchTree<Key, Value>::getHeight(Value ptr) const {
-    return ptr == nullptr ? -1 : ptr->height;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::remove(Key key) {
-    remove(key, root);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::makeEmpty() {
-    makeEmpty(root);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::makeEmpty(Value& ptr) {
-    if (ptr != nullptr) {
-        makeEmpty(ptr->left);
-        makeEmpty(ptr->right);
-        delete ptr;
-    }
-    ptr = nullptr;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::insert(Key key) {
-    insert(key, root);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::insert(Key key, Value& ptr) {
-    if (ptr == nullptr) {
-        ptr = new WordItem(key, nullptr, nullptr, 0);
-    }
-    else if (key < ptr->word) {
-        insert(key, ptr->left);
-        if (getHeight(ptr->left) - getHeight(ptr->right) == 2) {
-            if (key < ptr->left->word)
-                rotateWithLeftChild(ptr);
-            else
-                doubleWithLeftChild(ptr);
-        }
-    }
-    else if (ptr->word < key) {
-        insert(key, ptr->right);
-        if (getHeight(ptr->right) - getHeight(ptr->left) == 2) {
-            if (key > ptr->right->word)
-                rotateWithRightChild(ptr);
-            else
-                doubleWithRightChild(ptr);
-        }
-    }
-    ptr->height = max(getHeight(ptr->left), getHeight(ptr->right)) + 1;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::remove(Key key, Value& ptr) {
-    if (ptr == nullptr) return;
-
-    if (key < ptr->word) {
-        remove(key, ptr->left);
-    }
-    else if (key > ptr->word) {
-        remove(key, ptr->right);
-    }
-    else if (ptr->left != nullptr && ptr->right != nullptr) {
-        ptr->word = findMin(ptr->right)->word;
-        remove(ptr->word, ptr->right);
-    }
-    else {
-        Value oldNode = ptr;
-        ptr = (ptr->left != nullptr) ? ptr->left : ptr->right;
-        delete oldNode;
-    }
-
-    if (ptr != nullptr) {
-        ptr->height = max(getHeight(ptr->left), getHeight(ptr->right)) + 1;
-        int balance = getBalance(ptr);
-
-        if (balance > 1) {
-            if (getBalance(ptr->left) >= 0)
-                rotateWithLeftChild(ptr);
-            else
-                doubleWithLeftChild(ptr);
-        }
-        else if (balance < -1) {
-            if (getBalance(ptr->right) <= 0)
-                rotateWithRightChild(ptr);
-            else
-                doubleWithRightChild(ptr);
-        }
-    }
-}
-
-template<class Key, class Value>
-int AVLSearchTree<Key, Value>::getBalance(Value ptr) const {
-    return (ptr == nullptr) ? 0 : getHeight(ptr->left) - getHeight(ptr->right);
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::find(Key key) const {
-    return find(key, root);
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::find(Key key, Value ptr) const {
-    key = tolower_string(key);
-    if (ptr == nullptr) return nullptr;
-    if (key < ptr->word) return find(key, ptr->left);
-    if (key > ptr->word) return find(key, ptr->right);
-    return ptr;
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::findMin() const {
-    return findMin(root);
-}
-
-template<class Key, class Value>
-Value AVLSearchTree<Key, Value>::findMin(Value ptr) const {
-    if (ptr == nullptr) return nullptr;
-    if (ptr->left == nullptr) return ptr;
-    return findMin(ptr->left);
-}
-
-template <class Key, class Value>
-bool AVLSearchTree<Key, Value>::isEmpty() const {
-    return root == nullptr;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::rotateWithLeftChild(Value& k2) {
-    Value k1 = k2->left;
-    k2->left = k1->right;
-    k1->right = k2;
-    k2->height = max(getHeight(k2->left), getHeight(k2->right)) + 1;
-    k1->height = max(getHeight(k1->left), getHeight(k2)) + 1;
-    k2 = k1;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::rotateWithRightChild(Value& k1) {
-    Value k2 = k1->right;
-    k1->right = k2->left;
-    k2->left = k1;
-    k1->height = max(getHeight(k1->left), getHeight(k1->right)) + 1;
-    k2->height = max(getHeight(k2->right), getHeight(k1)) + 1;
-    k1 = k2;
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::doubleWithLeftChild(Value& k3) {
-    rotateWithRightChild(k3->left);
-    rotateWithLeftChild(k3);
-}
-
-template<class Key, class Value>
-void AVLSearchTree<Key, Value>::doubleWithRightChild(Value& k1) {
-    rotateWithLeftChild(k1->right);
-    rotateWithRightChild(k1);
-}
-
-struct HashNode {
-    string word;
-    vector<DocumentItem> details;
-};
-
-bool isPrime(int n) {
-    if (n == 2 || n == 3)
-        return true;
-    if (n == 1 || n % 2 == 0)
-        return false;
-    for (int i = 3; i * i <= n; i += 2)
-        if (n % i == 0)
-            return false;
-    return true;
-}
-
-int nextPrime(int n) {
-    if (n % 2 == 0)
-        n++;
-    while (!isPrime(n)) {
-        n += 2;
-    }
-    return n;
-}
-
-int hash_function(const string& key, int tableSize) {
-    int hashVal = 0;
-    for (char ch : key)
-        hashVal = 37 * hashVal + ch;
-    hashVal %= tableSize;
-    if (hashVal < 0)
-        hashVal += tableSize;
-    return hashVal;
-}
-
-template<class HashedObj, class Key>
-class HashTable {
-public:
-    enum EntryType { ACTIVE, EMPTY, DELETED };
-    HashTable() {
-        uniqueWordCount = 0;
-        array_hash.resize(53);
-    }
-
-    const HashedObj find(const Key& x) const {
-        int currentPos = findPos(x);
-        if (isActive(currentPos))
-            return array_hash[currentPos].element;
-        return nullptr;
-    }
-
-    void insert(const Key& x, const string& filename) {
-        int currentPos = findPos(x);
-        if (!isActive(currentPos)) {
-            HashNode* new_save = new HashNode();
-            new_save->word = x;
-            DocumentItem new_save_first_occurrence = { filename, 1 };
-            new_save->details.push_back(new_save_first_occurrence);
-            array_hash[currentPos].element = new_save;
-            array_hash[currentPos].info = ACTIVE;
-            uniqueWordCount++;
-        }
-        else {
-            HashNode* existingNode = array_hash[currentPos].element;
-            bool found = false;
-            for (auto& detail : existingNode->details) {
-                if (detail.documentName == filename) {
-                    detail.count++;
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                existingNode->details.push_back({ filename, 1 });
-            }
-        }
-        if (loadFactor() > 0.75) rehash();
-    }
-
-    void remove(const Key& x) {
-        int currentPos = findPos(x);
-        if (isActive(currentPos)) {
-            delete array_hash[currentPos].element;
-            array_hash[currentPos].element = nullptr;
-            array_hash[currentPos].info = DELETED;
-        }
-    }
-
-    float loadFactor() const {
-        return static_cast<float>(uniqueWordCount) / array_hash.size();
-    }
-
-    int getUniqueWordCount() const {
-        return uniqueWordCount;
-    }
-
-private:
-    struct HashEntry {
-        HashedObj element;
-        EntryType info;
-
-        HashEntry(EntryType i = EMPTY) : info(i), element(nullptr) {}
-    };
-
-    vector<HashEntry> array_hash;
-    int uniqueWordCount;
-
-    bool isActive(int currentPos) const {
-        return array_hash[currentPos].info == ACTIVE;
-    }
-
-    int findPos(const Key& x) const {
-        int collisionNum = 0;
-        int currentPos = hash_function(x, array_hash.size());
-        while (array_hash[currentPos].info != EMPTY &&
-            array_hash[currentPos].element->word != x) {
-            currentPos += ++collisionNum * collisionNum;
-            currentPos %= array_hash.size();
-        }
-        return currentPos;
-    }
-
-    void rehash() {
-        vector<HashEntry> oldArray = array_hash;
-        array_hash.resize(nextPrime(2 * oldArray.size()));
-        for (auto& entry : array_hash) {
-            entry.info = EMPTY;
-            entry.element = nullptr;
-        }
-        uniqueWordCount = 0;
-        for (auto& entry : oldArray) {
-            if (entry.info == ACTIVE) {
-                for (auto& detail : entry.element->details) {
-                    for (int i = 0; i < detail.count; i++) insert(entry.element->word, detail.documentName);
-                }
-                delete entry.element;
-            }
-        }
-        cout << "rehashed...\n";
-        cout << "previous table size: " << oldArray.size() << ", new table size: " << array_hash.size()
-            << ", current unique word count " << uniqueWordCount << ", current load factor: " << loadFactor() << "\n";
-    }
-};
-
-void processWord(string& word, AVLSearchTree<string, WordItem*>& myTree, HashTable<HashNode*, string>& hash_table, const string& filename) {
-    string word_lower = tolower_string(word);
-    if (all_of(word_lower.begin(), word_lower.end(), ::isalpha)) {
-        WordItem* foundWord = myTree.find(word_lower);
-        if (!foundWord) {
-            myTree.insert(word_lower);
-            foundWord = myTree.find(word_lower);
-            foundWord->details.push_back({ filename, 1 });
-        }
-        else {
-            auto it = find_if(foundWord->details.begin(), foundWord->details.end(),
-                [&filename](const DocumentItem& item) {
-                    return item.documentName == filename;
-                });
-            if (it != foundWord->details.end()) {
-                it->count++;
-            }
-            else {
-                foundWord->details.push_back({ filename, 1 });
-            }
-        }
-        hash_table.insert(word_lower, filename);
-    }
-}
-
-void processFile(const string& filename, AVLSearchTree<string, WordItem*>& myTree, HashTable<HashNode*, string>& hash_table) {
-    ifstream file(filename);
-    stringstream buffer;
-    buffer << file.rdbuf();
-    string content = buffer.str();
-
-    // Replace non-alphabetical characters and blanks with newlines
-    for (char& c : content) {
-        if (!isalpha(c)) {
-            c = '\n';
-        }
-    }
-
-    // Write the modified content back to the file
-    ofstream outfile(filename);
-    outfile << content;
-    outfile.close();
-
-    // Now process the file as usual
-    string word;
-    stringstream contentStream(content);
-    while (contentStream >> word) {
-        processWord(word, myTree, hash_table, filename);
-    }
-}
-
-vector<string> splitWords(const string& text) {
-    vector<string> words;
-    string word;
-    for (char c : text) {
-        if (isalpha(c)) {
-            word += c;
-        }
-        else {
-            if (!word.empty()) {
-                words.push_back(word);
-                word.clear();
-            }
-            words.push_back("\n");
-        }
-    }
-    if (!word.empty()) {
-        words.push_back(word);
-    }
-    return words;
-}
-
-int main() {
-    AVLSearchTree<string, WordItem*> myTree;
-    HashTable<HashNode*, string> hash_table;
-    int fileNum;
-    cout << "Enter number of input files: ";
-    cin >> fileNum;
-    vector<string> filenames(fileNum);
-    for (int i = 0; i < fileNum; ++i) {
-        cout << "Enter " << i + 1 << ". file name: ";
-        cin >> filenames[i];
-    }
-
-    for (const auto& filename : filenames) {
-        processFile(filename, myTree, hash_table);
-    }
-
-    cout << "After preprocessing, the unique word count is " << hash_table.getUniqueWordCount() << ". Current load ratio is " << hash_table.loadFactor() << "\n";
-
-    string search;
-    cout << "Enter queried words in one line: ";
-    cin.ignore();
-    getline(cin, search);
-
-    // Convert the entire input string to lowercase
-    search = tolower_string(search);
-
-    vector<string> queryWords = splitWords(search);
-
-    // Store results in maps for grouped output
-    map<string, map<string, int>> bstResults;
-    map<string, map<string, int>> hashTableResults;
-
-    bool allWordsFoundInBST = true;
-    bool allWordsFoundInHashTable = true;
-
-    // Collect results for AVL Tree
-    for (const auto& query : queryWords) {
-        if (query != "\n") {
-            WordItem* foundWord = myTree.find(query);
-            if (foundWord) {
-                for (const auto& detail : foundWord->details) {
-                    bstResults[detail.documentName][query] += detail.count;
-                }
-            }
-            else {
-                allWordsFoundInBST = false;
-            }
-        }
-    }
-
-    // Collect results for Hash Table
-    for (const auto& query : queryWords) {
-        if (query != "\n") {
-            const HashNode* foundNode = hash_table.find(query);
-            if (foundNode) {
-                for (const auto& detail : foundNode->details) {
-                    hashTableResults[detail.documentName][query] += detail.count;
-                }
-            }
-            else {
-                allWordsFoundInHashTable = false;
-            }
-        }
-    }
-
-    // Print the results for AVL Tree
-    if (!allWordsFoundInBST) {
-        cout << "No document contains the given query\n";
-    }
-    else {
-        for (const auto& doc : bstResults) {
-            cout << "in Document " << doc.first << ", ";
-            bool first = true;
-            for (const auto& word : doc.second) {
-                if (!first) cout << ", ";
-                cout << word.first << " found " << word.second << " times";
-                first = false;
-            }
-            cout << ".\n";
-        }
-    }
-
-    // Print the results for Hash Table
-    if (!allWordsFoundInHashTable) {
-        cout << "No document contains the given query\n";
-    }
-    else {
-        for (const auto& doc : hashTableResults) {
-            cout << "in Document " << doc.first << ", ";
-            bool first = true;
-            for (const auto& word : doc.second) {
-                if (!first) cout << ", ";
-                cout << word.first << " found " << word.second << " times";
-                first = false;
-            }
-            cout << ".\n";
-        }
-    }
-
-    int k = 20;
-    auto start = chrono::high_resolution_clock::now();
-    for (int i = 0; i < k; ++i) {
-        for (const auto& query : queryWords) {
-            myTree.find(query);
-        }
-    }
-    auto BSTTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
-
-    start = chrono::high_resolution_clock::now();
-    for (int i = 0; i < k; ++i) {
-        for (const auto& query : queryWords) {
-            hash_table.find(query);
-        }
-    }
-    auto HTTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
-
-    cout << "Time: " << BSTTime.count() / k << " ns\n";
-    cout << "Time: " << HTTime.count() / k << " ns\n";
-    cout << "Speed Up: " << static_cast<float>(BSTTime.count()) / HTTime.count() << "\n";
-
-    return 0;
-}
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cctype>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <string_view>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <memory>
+#include <cmath>
+#include <queue>
+#include <deque>
+#include <list>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <charconv>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+#ifdef COUNT_ALLOCATIONS
+// every heap allocation of the program is counted, for the allocations-per-find line of --bench-tree
+#include <atomic>
+atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (void* p = malloc(size == 0 ? 1 : size)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+// one posting: the document's id in the DocumentTable and how often the word occurs in it
+struct DocumentItem {
+    uint32_t documentId;
+    int count;
+};
+
+// Maps document names to dense ids in order of first appearance. Postings store only the id,
+// so a posting is 8 bytes and comparing documents is an integer compare.
+class DocumentTable {
+public:
+    uint32_t getId(const string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        uint32_t id = names.size();
+        ids.emplace(name, id);
+        names.push_back(name);
+        lengths.push_back(0);
+        return id;
+    }
+
+    const string& name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+    // document lengths in tokens, used by ranking
+    void addLength(uint32_t id, uint32_t tokens) {
+        lengths[id] += tokens;
+        totalLength += tokens;
+    }
+
+    uint32_t length(uint32_t id) const {
+        return lengths[id];
+    }
+
+    double averageLength() const {
+        return names.empty() ? 0.0 : static_cast<double>(totalLength) / names.size();
+    }
+
+    uint32_t minLength() const {
+        return lengths.empty() ? 0 : *min_element(lengths.begin(), lengths.end());
+    }
+
+private:
+    vector<string> names;
+    vector<uint32_t> lengths;
+    uint64_t totalLength = 0;
+    unordered_map<string, uint32_t> ids;
+};
+
+// Postings are kept sorted by document id. Files are ingested in id order, so the common
+// case bumps or appends at the back in O(1); only a file listed twice comes back with an
+// older id and takes the binary search. Returns the document's count after the update.
+int addPosting(vector<DocumentItem>& details, uint32_t documentId, int count) {
+    if (!details.empty() && details.back().documentId == documentId) {
+        return details.back().count += count;
+    }
+    if (details.empty() || details.back().documentId < documentId) {
+        details.push_back({ documentId, count });
+        return count;
+    }
+    auto it = lower_bound(details.begin(), details.end(), documentId,
+        [](const DocumentItem& item, uint32_t id) { return item.documentId < id; });
+    if (it != details.end() && it->documentId == documentId)
+        return it->count += count;
+    details.insert(it, { documentId, count });
+    return count;
+}
+
+// a read-only run of postings, from an engine's details vector or from a mapped index file
+struct PostingSpan {
+    const DocumentItem* items;
+    size_t size;
+};
+
+inline PostingSpan spanOf(const vector<DocumentItem>& details) {
+    return { details.data(), details.size() };
+}
+
+// number of the first n postings whose document id is below target, one posting at a time
+inline size_t countBelowScalar(const DocumentItem* items, size_t n, uint32_t target) {
+    size_t below = 0;
+    while (below < n && items[below].documentId < target) below++;
+    return below;
+}
+
+// number of the first 8 postings whose document id is below target
+inline size_t countBelow8(const DocumentItem* items, uint32_t target) {
+#ifdef HAVE_SSE2
+    // postings interleave (id, count); two shuffles gather the eight ids into two vectors,
+    // and flipping the sign bit turns the signed compare into an unsigned one
+    const __m128i flip = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    __m128i key = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(target)), flip);
+    const __m128* raw = reinterpret_cast<const __m128*>(items);
+    __m128i low = _mm_castps_si128(_mm_shuffle_ps(_mm_loadu_ps(reinterpret_cast<const float*>(raw)),
+        _mm_loadu_ps(reinterpret_cast<const float*>(raw + 1)), _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i high = _mm_castps_si128(_mm_shuffle_ps(_mm_loadu_ps(reinterpret_cast<const float*>(raw + 2)),
+        _mm_loadu_ps(reinterpret_cast<const float*>(raw + 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+    int lowMask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_xor_si128(low, flip), key)));
+    int highMask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_xor_si128(high, flip), key)));
+    // ids are sorted, so the set bits form a prefix and their count is the position
+    static const uint8_t bitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    return bitCount[lowMask] + bitCount[highMask];
+#else
+    return countBelowScalar(items, 8, target);
+#endif
+}
+
+// First position at or after from whose document id is not below target. Gallops with doubling
+// steps and binary searches the bracket down to at most 16 postings, which are then compared 8
+// at a time with a scalar tail. blocks, when given, counts the 8-wide compares.
+inline size_t gallopTo(PostingSpan list, size_t from, uint32_t target, size_t* blocks = nullptr) {
+    if (from >= list.size || list.items[from].documentId >= target) return from;
+    size_t low = from, step = 1;
+    while (low + step < list.size && list.items[low + step].documentId < target) {
+        low += step;
+        step *= 2;
+    }
+    // items[low] < target, and items[high] >= target or high == size
+    size_t high = min(low + step, list.size);
+    while (high - low > 16) {
+        size_t mid = low + (high - low) / 2;
+        if (list.items[mid].documentId < target) low = mid;
+        else high = mid;
+    }
+    size_t position = low + 1;
+    while (high - position >= 8) {
+        size_t below = countBelow8(list.items + position, target);
+        if (blocks) ++*blocks;
+        position += below;
+        if (below < 8) return position;
+    }
+    return position + countBelowScalar(list.items + position, high - position, target);
+}
+
+// Documents present in every list. Starts from the shortest list and gallops through the
+// others in increasing length, stopping as soon as no candidate is left.
+vector<uint32_t> intersectPostings(vector<PostingSpan> lists) {
+    vector<uint32_t> candidates;
+    if (lists.empty()) return candidates;
+    sort(lists.begin(), lists.end(), [](const PostingSpan& a, const PostingSpan& b) { return a.size < b.size; });
+    for (size_t i = 0; i < lists[0].size; i++) candidates.push_back(lists[0].items[i].documentId);
+
+    for (size_t l = 1; l < lists.size() && !candidates.empty(); l++) {
+        size_t cursor = 0, kept = 0;
+        for (uint32_t candidate : candidates) {
+            cursor = gallopTo(lists[l], cursor, candidate);
+            if (cursor == lists[l].size) break;
+            if (lists[l].items[cursor].documentId == candidate) candidates[kept++] = candidate;
+        }
+        candidates.resize(kept);
+    }
+    return candidates;
+}
+
+// Fills results with every word's count in each document that contains all the words; returns
+// false when no document does. lookup(word, span) reports whether word is indexed and where
+// its postings are, documentName(id) names a document.
+template<class Lookup, class NameOf>
+bool conjunctiveResults(const vector<string>& queryWords, Lookup lookup, NameOf documentName,
+    map<string, map<string, int>>& results) {
+    vector<string> words;
+    vector<PostingSpan> lists;
+    for (const auto& query : queryWords) {
+        if (query == "\n") continue;
+        PostingSpan span;
+        if (!lookup(query, span)) return false;
+        words.push_back(query);
+        lists.push_back(span);
+    }
+    vector<uint32_t> matching = intersectPostings(lists);
+    if (matching.empty()) return false;
+
+    for (size_t w = 0; w < words.size(); w++) {
+        size_t cursor = 0;
+        for (uint32_t documentId : matching) {
+            cursor = gallopTo(lists[w], cursor, documentId);
+            results[documentName(documentId)][words[w]] += lists[w].items[cursor].count;
+        }
+    }
+    return true;
+}
+
+// a query word prepared for ranking: its postings and the largest count among them
+struct RankedTerm {
+    PostingSpan postings;
+    int maxCount;
+};
+
+struct ScoredDocument {
+    uint32_t documentId;
+    double score;
+};
+
+// Okapi BM25 with the usual k1 = 1.2 and b = 0.75
+class BM25 {
+public:
+    explicit BM25(const DocumentTable& documents)
+        : documents(documents), averageLength(max(1.0, documents.averageLength())) {}
+
+    double idf(size_t documentFrequency) const {
+        double n = documents.size();
+        return log(1.0 + (n - documentFrequency + 0.5) / (documentFrequency + 0.5));
+    }
+
+    // grows with count and shrinks with length, so (maxCount, minLength) bounds a whole list
+    double termScore(double idf, int count, uint32_t length) const {
+        double norm = K1 * (1.0 - B + B * length / averageLength);
+        return idf * count * (K1 + 1.0) / (count + norm);
+    }
+
+    uint32_t length(uint32_t documentId) const {
+        return documents.length(documentId);
+    }
+
+private:
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+    const DocumentTable& documents;
+    double averageLength;
+};
+
+// true when a ranks above b: higher score first, lower document id on ties
+inline bool ranksAbove(const ScoredDocument& a, const ScoredDocument& b) {
+    return a.score > b.score || (a.score == b.score && a.documentId < b.documentId);
+}
+
+vector<ScoredDocument> drainRanking(priority_queue<ScoredDocument, vector<ScoredDocument>, decltype(&ranksAbove)>& heap) {
+    vector<ScoredDocument> ranking;
+    for (; !heap.empty(); heap.pop()) ranking.push_back(heap.top());
+    reverse(ranking.begin(), ranking.end());
+    return ranking;
+}
+
+// Top k documents by BM25 over the union of the terms' postings, using MaxScore: terms are
+// ordered by their score bound, and once the heap is full the cheapest terms whose bounds add up
+// to no more than the k-th score become non-essential. Documents are only drawn from the
+// essential terms, and non-essential ones are probed by galloping only while they could still
+// lift the document into the top k.
+vector<ScoredDocument> rankTopK(const vector<RankedTerm>& terms, const DocumentTable& documents, size_t k) {
+    struct TermState {
+        PostingSpan postings;
+        double idf;
+        double bound;
+        size_t cursor;
+    };
+    BM25 bm25(documents);
+    uint32_t minLength = documents.minLength();
+    vector<TermState> states;
+    for (const auto& term : terms) {
+        if (term.postings.size == 0) continue;
+        double idf = bm25.idf(term.postings.size);
+        states.push_back({ term.postings, idf, bm25.termScore(idf, term.maxCount, minLength), 0 });
+    }
+    sort(states.begin(), states.end(), [](const TermState& a, const TermState& b) { return a.bound < b.bound; });
+    // boundSum[i] bounds what terms 0..i can add together
+    vector<double> boundSum(states.size());
+    for (size_t i = 0; i < states.size(); i++) boundSum[i] = states[i].bound + (i > 0 ? boundSum[i - 1] : 0.0);
+
+    priority_queue<ScoredDocument, vector<ScoredDocument>, decltype(&ranksAbove)> heap(&ranksAbove);
+    if (k == 0) return drainRanking(heap);
+    double threshold = -1.0;
+    size_t firstEssential = 0;
+    while (firstEssential < states.size()) {
+        uint32_t documentId = UINT32_MAX;
+        for (size_t i = firstEssential; i < states.size(); i++) {
+            const TermState& state = states[i];
+            if (state.cursor < state.postings.size)
+                documentId = min(documentId, state.postings.items[state.cursor].documentId);
+        }
+        if (documentId == UINT32_MAX) break;
+
+        double score = 0.0;
+        uint32_t length = bm25.length(documentId);
+        for (size_t i = firstEssential; i < states.size(); i++) {
+            TermState& state = states[i];
+            if (state.cursor < state.postings.size && state.postings.items[state.cursor].documentId == documentId) {
+                score += bm25.termScore(state.idf, state.postings.items[state.cursor].count, length);
+                state.cursor++;
+            }
+        }
+        for (size_t i = firstEssential; i-- > 0;) {
+            if (score + boundSum[i] <= threshold) break;
+            TermState& state = states[i];
+            state.cursor = gallopTo(state.postings, state.cursor, documentId);
+            if (state.cursor < state.postings.size && state.postings.items[state.cursor].documentId == documentId)
+                score += bm25.termScore(state.idf, state.postings.items[state.cursor].count, length);
+        }
+
+        // documents arrive in increasing id order, so a tie with the k-th score never ranks above it
+        if (heap.size() < k) {
+            heap.push({ documentId, score });
+        }
+        else if (score > threshold) {
+            heap.pop();
+            heap.push({ documentId, score });
+        }
+        if (heap.size() == k) {
+            threshold = heap.top().score;
+            while (firstEssential < states.size() && boundSum[firstEssential] <= threshold) firstEssential++;
+        }
+    }
+    return drainRanking(heap);
+}
+
+// scores every document in the union, the reference for rankTopK
+vector<ScoredDocument> rankExhaustive(const vector<RankedTerm>& terms, const DocumentTable& documents, size_t k) {
+    BM25 bm25(documents);
+    vector<double> scores(documents.size(), 0.0);
+    vector<char> touched(documents.size(), 0);
+    for (const auto& term : terms) {
+        if (term.postings.size == 0) continue;
+        double idf = bm25.idf(term.postings.size);
+        for (size_t i = 0; i < term.postings.size; i++) {
+            const DocumentItem& detail = term.postings.items[i];
+            scores[detail.documentId] += bm25.termScore(idf, detail.count, bm25.length(detail.documentId));
+            touched[detail.documentId] = 1;
+        }
+    }
+    vector<ScoredDocument> ranking;
+    for (uint32_t id = 0; id < documents.size(); id++)
+        if (touched[id]) ranking.push_back({ id, scores[id] });
+    size_t top = min(k, ranking.size());
+    partial_sort(ranking.begin(), ranking.begin() + top, ranking.end(), ranksAbove);
+    ranking.resize(top);
+    return ranking;
+}
+
+// a word of the tree; the letters belong to whoever inserted them and the postings are kept
+// in the index's TermStore under term
+struct WordItem {
+    string_view word;
+    WordItem* left = nullptr;
+    WordItem* right = nullptr;
+    uint32_t term = 0;
+    int height;
+
+    WordItem(string_view word, WordItem* left = nullptr, WordItem* right = nullptr, int height = 0) :
+        word(word), left(left), right(right), height(height) {}
+};
+
+// Every distinct word of an index is stored here once. The letters go into fixed chunks that are
+// never moved, so the engines hold string_views of them, and the postings are one list per term.
+// Terms are numbered densely in order of first appearance and the ids stay valid for good.
+class TermStore {
+public:
+    TermStore() = default;
+    TermStore(const TermStore&) = delete;
+    TermStore& operator=(const TermStore&) = delete;
+
+    // the word must not be in the store yet
+    uint32_t add(string_view word) {
+        if (chunks.empty() || chunkUsed + word.size() > CHUNK_SIZE) {
+            chunks.emplace_back(new char[max(CHUNK_SIZE, word.size())]);
+            chunkUsed = 0;
+        }
+        char* letters = chunks.back().get() + chunkUsed;
+        memcpy(letters, word.data(), word.size());
+        chunkUsed += word.size();
+        words.emplace_back(letters, word.size());
+        postingLists.emplace_back();
+        maxCounts.push_back(0);
+        return static_cast<uint32_t>(words.size() - 1);
+    }
+
+    void addPosting(uint32_t term, uint32_t documentId, int count) {
+        maxCounts[term] = max(maxCounts[term], ::addPosting(postingLists[term], documentId, count));
+    }
+
+    string_view word(uint32_t term) const {
+        return words[term];
+    }
+
+    const vector<DocumentItem>& postings(uint32_t term) const {
+        return postingLists[term];
+    }
+
+    // largest count in the term's postings, bounds its ranking score
+    int maxCount(uint32_t term) const {
+        return maxCounts[term];
+    }
+
+    size_t size() const {
+        return words.size();
+    }
+
+    size_t postingCount() const {
+        size_t count = 0;
+        for (const auto& list : postingLists) count += list.size();
+        return count;
+    }
+
+    // bytes of letters, per term bookkeeping and posting lists, as allocated
+    size_t memoryUsage() const {
+        size_t bytes = chunks.size() * CHUNK_SIZE
+            + words.capacity() * sizeof(string_view)
+            + postingLists.capacity() * sizeof(vector<DocumentItem>)
+            + maxCounts.capacity() * sizeof(int);
+        for (const auto& list : postingLists) bytes += list.capacity() * sizeof(DocumentItem);
+        return bytes;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> chunks;
+    size_t chunkUsed = 0;
+    vector<string_view> words;
+    vector<vector<DocumentItem>> postingLists;
+    vector<int> maxCounts;
+};
+
+// a word of a TermStore under its id, as a sorted vocabulary is handed around between the engines
+struct TermEntry {
+    string_view word;
+    uint32_t term;
+};
+
+string tolower_string(string s) {
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); });
+    return s;
+}
+
+// the key itself when it has no upper case letters, otherwise its lower case copy in buffer;
+// copies of words up to 15 letters stay in the string's inline storage
+string_view lowerKey(string_view key, string& buffer) {
+    for (size_t i = 0; i < key.size(); i++) {
+        if (isupper(static_cast<unsigned char>(key[i]))) {
+            buffer.assign(key.data(), key.size());
+            for (size_t j = i; j < buffer.size(); j++) buffer[j] = static_cast<char>(tolower(static_cast<unsigned char>(buffer[j])));
+            return buffer;
+        }
+    }
+    return key;
+}
+
+// node allocation policies for AVLSearchTree: create() constructs a node, destroy() ends one,
+// and release() is called once the tree is emptied. When RELEASES_NODES is set, release() also
+// frees nodes that were never destroyed, so a tree whose nodes need no destructor skips the walk.
+
+// one heap allocation per node
+template <class Node>
+class NewDeleteAllocator {
+public:
+    template <class... Args>
+    Node* create(Args&&... args) {
+        return new Node(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        delete node;
+    }
+
+    void release() {}
+
+    static constexpr bool RELEASES_NODES = false;
+};
+
+// Nodes are carved out of slabs that double in size, so neighbours in insertion order sit next
+// to each other. Destroyed nodes go on a free list for reuse, and release() hands back whole
+// slabs instead of one node at a time.
+template <class Node>
+class ArenaAllocator {
+public:
+    ArenaAllocator() = default;
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    template <class... Args>
+    Node* create(Args&&... args) {
+        Slot* slot = freeList;
+        if (slot != nullptr) {
+            freeList = slot->next;
+        }
+        else {
+            if (used == slabSize) grow();
+            slot = &slabs.back()[used++];
+        }
+        return new (slot->storage) Node(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        node->~Node();
+        Slot* slot = reinterpret_cast<Slot*>(node);
+        slot->next = freeList;
+        freeList = slot;
+    }
+
+    void release() {
+        slabs.clear();
+        slabSize = used = 0;
+        freeList = nullptr;
+    }
+
+    static constexpr bool RELEASES_NODES = true;
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(Node) unsigned char storage[sizeof(Node)];
+    };
+
+    static constexpr size_t FIRST_SLAB = 64;
+    static constexpr size_t LARGEST_SLAB = 16384;
+
+    void grow() {
+        slabSize = slabSize == 0 ? FIRST_SLAB : min(2 * slabSize, LARGEST_SLAB);
+        slabs.emplace_back(new Slot[slabSize]);
+        used = 0;
+    }
+
+    vector<unique_ptr<Slot[]>> slabs;
+    size_t slabSize = 0;
+    size_t used = 0;
+    Slot* freeList = nullptr;
+};
+
+template <class Key, class Value, class Allocator = ArenaAllocator<typename remove_pointer<Value>::type>>
+class AVLSearchTree {
+    // an AVL tree of height 64 would need more nodes than fit in memory
+    static constexpr int MAX_HEIGHT = 64;
+
+public:
+    // In-order iterator. It holds the nodes still to be visited on the way back up, so seeking
+    // costs one descent and each step is O(1) amortized.
+    class Iterator {
+    public:
+        const WordItem& operator*() const { return *stack[depth - 1]; }
+        const WordItem* operator->() const { return stack[depth - 1]; }
+
+        Iterator& operator++() {
+            pushLeftSpine(stack[--depth]->right);
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            if (depth == 0 || other.depth == 0) return depth == other.depth;
+            return stack[depth - 1] == other.stack[other.depth - 1];
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class AVLSearchTree;
+
+        void pushLeftSpine(Value node) {
+            for (; node != nullptr; node = node->left) stack[depth++] = node;
+        }
+
+        Value stack[MAX_HEIGHT];
+        int depth = 0;
+    };
+
+    AVLSearchTree();
+    ~AVLSearchTree();
+    void insert(string_view key);
+    Value upsert(string_view key);
+    void remove(string_view key);
+    template<class ForwardIt>
+    size_t removeAll(ForwardIt first, ForwardIt last);
+    Value find(string_view key) const;
+    Value findMin() const;
+    void makeEmpty();
+    bool isEmpty() const;
+    size_t size() const;
+    int getBalance(Value ptr) const;
+    template<class Visitor>
+    void forEach(Visitor visit) const;
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lowerBound(string_view key) const;
+    template<class Visitor>
+    size_t forEachWithPrefix(string_view prefix, size_t limit, Visitor visit) const;
+    template<class Visitor>
+    size_t forEachInRange(string_view first, string_view last, size_t limit, Visitor visit) const;
+    template<class RandomIt>
+    void bulkLoad(RandomIt first, RandomIt last);
+
+    void rotateWithLeftChild(Value& k2);
+    void rotateWithRightChild(Value& k1);
+    void doubleWithLeftChild(Value& k3);
+    void doubleWithRightChild(Value& k1);
+
+private:
+    Value root = nullptr;
+    size_t nodeCount = 0;
+    Allocator nodes;
+    bool unlink(string_view key);
+    Value relink(Value* first, Value* last);
+    void rebalance(Value* path[], int depth);
+    template<class RandomIt>
+    Value build(RandomIt first, RandomIt last);
+    void makeEmpty(Value& ptr);
+    Value findMin(Value ptr) const;
+    int getHeight(Value ptr) const;
+    template<class Visitor>
+    void forEach(Value ptr, Visitor& visit) const;
+};
+
+template <class Key, class Value, class Allocator>
+AVLSearchTree<Key, Value, Allocator>::AVLSearchTree() {
+    root = nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+AVLSearchTree<Key, Value, Allocator>::~AVLSearchTree() {
+    makeEmpty();
+}
+
+template<class Key, class Value, class Allocator>
+int AVLSearchTree<Key, Value, Allocator>::getHeight(Value ptr) const {
+    return ptr == nullptr ? -1 : ptr->height;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::makeEmpty() {
+    if (!Allocator::RELEASES_NODES || !is_trivially_destructible<typename remove_pointer<Value>::type>::value)
+        makeEmpty(root);
+    root = nullptr;
+    nodeCount = 0;
+    nodes.release();
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::makeEmpty(Value& ptr) {
+    if (ptr != nullptr) {
+        makeEmpty(ptr->left);
+        makeEmpty(ptr->right);
+        nodes.destroy(ptr);
+    }
+    ptr = nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::insert(string_view key) {
+    upsert(key);
+}
+
+// finds the node of a lower case key, inserting it first if it is missing, in a single descent;
+// a new node refers to the key's letters, which must outlive it
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::upsert(string_view key) {
+    Value* path[MAX_HEIGHT];
+    int depth = 0;
+    Value* link = &root;
+    while (*link != nullptr) {
+        int order = key.compare((*link)->word);
+        if (order == 0) return *link;
+        path[depth++] = link;
+        link = order < 0 ? &(*link)->left : &(*link)->right;
+    }
+    Value node = nodes.create(key);
+    *link = node;
+    nodeCount++;
+    rebalance(path, depth);
+    return node;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::remove(string_view key) {
+    string buffer;
+    unlink(lowerKey(key, buffer));
+}
+
+// Removes every key of the range and returns how many were there. The keys are sorted first,
+// so neighbouring removals walk the same paths. A batch of at least a quarter of the tree
+// postpones all rebalancing: one in-order pass drops the removed nodes while stepping through
+// the keys, and the survivors are relinked into a balanced tree without moving a node. Smaller
+// batches are removed one by one in key order.
+template<class Key, class Value, class Allocator>
+template<class ForwardIt>
+size_t AVLSearchTree<Key, Value, Allocator>::removeAll(ForwardIt first, ForwardIt last) {
+    vector<string_view> keys;
+    deque<string> lowered;  // lower case copies of the keys that had capitals
+    for (; first != last; ++first) {
+        string buffer;
+        string_view key = lowerKey(*first, buffer);
+        if (key.data() == buffer.data()) {
+            lowered.push_back(std::move(buffer));
+            key = lowered.back();
+        }
+        keys.push_back(key);
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    size_t removed = 0;
+    if (keys.size() * 4 < nodeCount) {
+        for (const auto& key : keys) removed += unlink(key);
+        return removed;
+    }
+
+    vector<Value> survivors;
+    survivors.reserve(nodeCount);
+    auto key = keys.begin();
+    Value stack[MAX_HEIGHT];
+    int depth = 0;
+    Value node = root;
+    while (node != nullptr || depth > 0) {
+        for (; node != nullptr; node = node->left) stack[depth++] = node;
+        Value current = stack[--depth];
+        node = current->right;
+        while (key != keys.end() && *key < current->word) ++key;
+        if (key != keys.end() && *key == current->word) {
+            nodes.destroy(current);
+            removed++;
+        }
+        else {
+            survivors.push_back(current);
+        }
+    }
+    nodeCount -= removed;
+    root = relink(survivors.data(), survivors.data() + survivors.size());
+    return removed;
+}
+
+// the middle node becomes the root of its range, like build() but over existing nodes
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::relink(Value* first, Value* last) {
+    if (first == last) return nullptr;
+    Value* middle = first + (last - first) / 2;
+    Value node = *middle;
+    node->left = relink(first, middle);
+    node->right = relink(middle + 1, last);
+    node->height = max(getHeight(node->left), getHeight(node->right)) + 1;
+    return node;
+}
+
+// takes the node of a lower case key out of the tree and rebalances the path to it
+template<class Key, class Value, class Allocator>
+bool AVLSearchTree<Key, Value, Allocator>::unlink(string_view key) {
+    Value* path[MAX_HEIGHT];
+    int depth = 0;
+    Value* link = &root;
+    while (*link != nullptr) {
+        int order = key.compare((*link)->word);
+        if (order == 0) break;
+        path[depth++] = link;
+        link = order < 0 ? &(*link)->left : &(*link)->right;
+    }
+    Value node = *link;
+    if (node == nullptr) return false;
+
+    if (node->left != nullptr && node->right != nullptr) {
+        // the successor's word and term move into this node, and the successor is unlinked instead
+        path[depth++] = link;
+        Value* successorLink = &node->right;
+        while ((*successorLink)->left != nullptr) {
+            path[depth++] = successorLink;
+            successorLink = &(*successorLink)->left;
+        }
+        Value successor = *successorLink;
+        node->word = successor->word;
+        node->term = successor->term;
+        *successorLink = successor->right;
+        nodes.destroy(successor);
+    }
+    else {
+        *link = (node->left != nullptr) ? node->left : node->right;
+        nodes.destroy(node);
+    }
+    nodeCount--;
+    rebalance(path, depth);
+    return true;
+}
+
+// Walks the links recorded on the way down back up, fixing heights and rotating where one side
+// grew two taller. Stops at the first subtree whose height is unchanged, nothing above it moves.
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rebalance(Value* path[], int depth) {
+    for (int i = depth; i-- > 0;) {
+        Value& ptr = *path[i];
+        int oldHeight = ptr->height;
+        ptr->height = max(getHeight(ptr->left), getHeight(ptr->right)) + 1;
+        int balance = getBalance(ptr);
+
+        if (balance > 1) {
+            if (getBalance(ptr->left) >= 0)
+                rotateWithLeftChild(ptr);
+            else
+                doubleWithLeftChild(ptr);
+        }
+        else if (balance < -1) {
+            if (getBalance(ptr->right) <= 0)
+                rotateWithRightChild(ptr);
+            else
+                doubleWithRightChild(ptr);
+        }
+        if (ptr->height == oldHeight) break;
+    }
+}
+
+template<class Key, class Value, class Allocator>
+int AVLSearchTree<Key, Value, Allocator>::getBalance(Value ptr) const {
+    return (ptr == nullptr) ? 0 : getHeight(ptr->left) - getHeight(ptr->right);
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::find(string_view key) const {
+    string buffer;
+    key = lowerKey(key, buffer);
+    Value ptr = root;
+    while (ptr != nullptr) {
+        int order = key.compare(ptr->word);
+        if (order == 0) return ptr;
+        ptr = order < 0 ? ptr->left : ptr->right;
+    }
+    return nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::findMin() const {
+    return findMin(root);
+}
+
+template<class Key, class Value, class Allocator>
+Value AVLSearchTree<Key, Value, Allocator>::findMin(Value ptr) const {
+    if (ptr == nullptr) return nullptr;
+    if (ptr->left == nullptr) return ptr;
+    return findMin(ptr->left);
+}
+
+template <class Key, class Value, class Allocator>
+bool AVLSearchTree<Key, Value, Allocator>::isEmpty() const {
+    return root == nullptr;
+}
+
+template<class Key, class Value, class Allocator>
+size_t AVLSearchTree<Key, Value, Allocator>::size() const {
+    return nodeCount;
+}
+
+// visits the nodes in key order
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+void AVLSearchTree<Key, Value, Allocator>::forEach(Visitor visit) const {
+    forEach(root, visit);
+}
+
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+void AVLSearchTree<Key, Value, Allocator>::forEach(Value ptr, Visitor& visit) const {
+    if (ptr == nullptr) return;
+    forEach(ptr->left, visit);
+    visit(static_cast<const WordItem*>(ptr));
+    forEach(ptr->right, visit);
+}
+
+template<class Key, class Value, class Allocator>
+typename AVLSearchTree<Key, Value, Allocator>::Iterator AVLSearchTree<Key, Value, Allocator>::begin() const {
+    Iterator it;
+    it.pushLeftSpine(root);
+    return it;
+}
+
+template<class Key, class Value, class Allocator>
+typename AVLSearchTree<Key, Value, Allocator>::Iterator AVLSearchTree<Key, Value, Allocator>::end() const {
+    return Iterator();
+}
+
+// first word not less than a lower case key; the nodes where the descent turned left are the
+// ones still to come after it
+template<class Key, class Value, class Allocator>
+typename AVLSearchTree<Key, Value, Allocator>::Iterator AVLSearchTree<Key, Value, Allocator>::lowerBound(string_view key) const {
+    Iterator it;
+    Value ptr = root;
+    while (ptr != nullptr) {
+        int order = key.compare(ptr->word);
+        if (order > 0) {
+            ptr = ptr->right;
+            continue;
+        }
+        it.stack[it.depth++] = ptr;
+        if (order == 0) break;
+        ptr = ptr->left;
+    }
+    return it;
+}
+
+// visits up to limit words starting with a lower case prefix in order, returns how many it visited
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+size_t AVLSearchTree<Key, Value, Allocator>::forEachWithPrefix(string_view prefix, size_t limit, Visitor visit) const {
+    size_t visited = 0;
+    for (Iterator it = lowerBound(prefix); it != end() && visited < limit; ++it, ++visited) {
+        if (it->word.compare(0, prefix.size(), prefix.data(), prefix.size()) != 0) break;
+        visit(*it);
+    }
+    return visited;
+}
+
+// visits up to limit words between first and last, both included, in order
+template<class Key, class Value, class Allocator>
+template<class Visitor>
+size_t AVLSearchTree<Key, Value, Allocator>::forEachInRange(string_view first, string_view last, size_t limit, Visitor visit) const {
+    size_t visited = 0;
+    for (Iterator it = lowerBound(first); it != end() && visited < limit; ++it, ++visited) {
+        if (last.compare(it->word) < 0) break;
+        visit(*it);
+    }
+    return visited;
+}
+
+// Replaces the contents with a perfectly balanced tree over a range of entries sorted by word
+// without duplicates, taking over their words and terms. Linear, as nothing is compared or rotated.
+template<class Key, class Value, class Allocator>
+template<class RandomIt>
+void AVLSearchTree<Key, Value, Allocator>::bulkLoad(RandomIt first, RandomIt last) {
+    makeEmpty();
+    root = build(first, last);
+    nodeCount = last - first;
+}
+
+// the middle entry becomes the root of its range; nodes are created in order, so the entries
+// are read front to back and neighbouring words share slabs
+template<class Key, class Value, class Allocator>
+template<class RandomIt>
+Value AVLSearchTree<Key, Value, Allocator>::build(RandomIt first, RandomIt last) {
+    if (first == last) return nullptr;
+    RandomIt middle = first + (last - first) / 2;
+    Value left = build(first, middle);
+    Value node = nodes.create(middle->word, left);
+    node->term = middle->term;
+    node->right = build(middle + 1, last);
+    node->height = max(getHeight(node->left), getHeight(node->right)) + 1;
+    return node;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rotateWithLeftChild(Value& k2) {
+    Value k1 = k2->left;
+    k2->left = k1->right;
+    k1->right = k2;
+    k2->height = max(getHeight(k2->left), getHeight(k2->right)) + 1;
+    k1->height = max(getHeight(k1->left), getHeight(k2)) + 1;
+    k2 = k1;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::rotateWithRightChild(Value& k1) {
+    Value k2 = k1->right;
+    k1->right = k2->left;
+    k2->left = k1;
+    k1->height = max(getHeight(k1->left), getHeight(k1->right)) + 1;
+    k2->height = max(getHeight(k2->right), getHeight(k1)) + 1;
+    k1 = k2;
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::doubleWithLeftChild(Value& k3) {
+    rotateWithRightChild(k3->left);
+    rotateWithLeftChild(k3);
+}
+
+template<class Key, class Value, class Allocator>
+void AVLSearchTree<Key, Value, Allocator>::doubleWithRightChild(Value& k1) {
+    rotateWithLeftChild(k1->right);
+    rotateWithRightChild(k1);
+}
+
+struct HashNode {
+    string_view word;
+    uint64_t hash;
+    uint32_t term;
+};
+
+bool isPrime(int n) {
+    if (n == 2 || n == 3)
+        return true;
+    if (n == 1 || n % 2 == 0)
+        return false;
+    for (int i = 3; i * i <= n; i += 2)
+        if (n % i == 0)
+            return false;
+    return true;
+}
+
+int nextPrime(int n) {
+    if (n % 2 == 0)
+        n++;
+    while (!isPrime(n)) {
+        n += 2;
+    }
+    return n;
+}
+
+// the original byte-at-a-time hash, kept for the comparison in --bench-hash
+int hash_function(const string& key, int tableSize) {
+    int hashVal = 0;
+    for (char ch : key)
+        hashVal = 37 * hashVal + ch;
+    hashVal %= tableSize;
+    if (hashVal < 0)
+        hashVal += tableSize;
+    return hashVal;
+}
+
+// index of the lowest set bit, mask must not be zero
+inline int countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// 64x64 -> 128 bit multiply, a receives the low and b the high half
+inline void multiply128(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+    a = lo;
+    b = hi;
+#endif
+}
+
+inline uint64_t mix64(uint64_t a, uint64_t b) {
+    multiply128(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// wyhash style hash that consumes 8 or 16 bytes per step; tokens of up to 16 bytes, which is
+// nearly every word, are covered by two overlapping reads and a single multiply
+uint64_t word_hash(string_view key) {
+    static const uint64_t secret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                        0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(key.data());
+    size_t len = key.size();
+    uint64_t seed = secret[0] ^ mix64(secret[0], secret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t shift = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - shift);
+        }
+        else if (len > 0) {
+            a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t remaining = len;
+        while (remaining > 16) {
+            seed = mix64(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        a = read64(p + remaining - 16);
+        b = read64(p + remaining - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    multiply128(a, b);
+    return mix64(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+template<class HashedObj, class Key>
+class HashTable {
+public:
+    enum EntryType { EMPTY, ACTIVE, DELETED };
+
+    // STOP_THE_WORLD migrates every entry as soon as the load factor is exceeded,
+    // INCREMENTAL keeps the old table alive and drains a few slots per insert.
+    // REPLAY is the original rehash, kept as the baseline of --bench-rehash: every word is
+    // inserted again through insert, with a new node allocated and the old one freed.
+    enum RehashMode { STOP_THE_WORLD, INCREMENTAL, REPLAY };
+
+    HashTable(RehashMode mode = STOP_THE_WORLD) : mode(mode) {
+        uniqueWordCount = 0;
+        tombstoneCount = 0;
+        migratePos = 0;
+        array_hash.assign(53);
+    }
+
+    ~HashTable() {
+        for (auto& entry : array_hash)
+            if (entry.info == ACTIVE) delete entry.element;
+        for (auto& entry : old_hash)
+            if (entry.info == ACTIVE) delete entry.element;
+    }
+
+    HashTable(const HashTable&) = delete;
+    HashTable& operator=(const HashTable&) = delete;
+
+    const HashedObj find(const Key& x) const {
+        uint64_t hash = word_hash(x);
+        int currentPos = findPos(array_hash, x, hash);
+        if (isActive(array_hash, currentPos))
+            return array_hash[currentPos].element;
+        if (isMigrating()) {
+            currentPos = findPos(old_hash, x, hash);
+            if (isActive(old_hash, currentPos))
+                return old_hash[currentPos].element;
+        }
+        return nullptr;
+    }
+
+    // adds x under term unless it is there already; the node refers to x's letters, which must outlive it
+    void insert(const Key& x, uint32_t term) {
+        if (isMigrating()) migrateStep();
+
+        uint64_t hash = word_hash(x);
+        int deletedPos;
+        int currentPos = findPos(array_hash, x, hash, &deletedPos);
+        if (isActive(array_hash, currentPos)) return;
+
+        HashedObj node = nullptr;
+        if (isMigrating()) {
+            // the word may still sit in the old table, pull it over instead of adding it twice
+            int oldPos = findPos(old_hash, x, hash);
+            if (isActive(old_hash, oldPos)) {
+                node = old_hash[oldPos].element;
+                old_hash[oldPos].element = nullptr;
+                old_hash[oldPos].info = DELETED;
+            }
+        }
+        if (node == nullptr) {
+            node = new HashNode();
+            node->word = x;
+            node->hash = hash;
+            node->term = term;
+            uniqueWordCount++;
+        }
+        place(array_hash, currentPos, deletedPos, node);
+        if (fill() > 0.75) rehash(uniqueWordCount * 2 > getTableSize() ? nextPrime(2 * getTableSize()) : getTableSize());
+    }
+
+    void remove(const Key& x) {
+        if (removeOne(x)) compactIfSparse();
+    }
+
+    // Removes every key of the range and returns how many were there. The tombstones are only
+    // looked at once at the end, so a large batch compacts the table at most once.
+    template<class InputIt>
+    size_t removeAll(InputIt first, InputIt last) {
+        size_t removed = 0;
+        for (; first != last; ++first) removed += removeOne(*first);
+        if (removed > 0) compactIfSparse();
+        return removed;
+    }
+
+    float loadFactor() const {
+        return static_cast<float>(uniqueWordCount) / array_hash.size();
+    }
+
+    int getUniqueWordCount() const {
+        return uniqueWordCount;
+    }
+
+    int getTombstoneCount() const {
+        return tombstoneCount;
+    }
+
+    // probes a lookup of each stored word of the current table takes, on average and at worst
+    void probeLengths(double& average, int& longest) const {
+        long long total = 0;
+        int active = 0;
+        longest = 0;
+        for (size_t i = 0; i < array_hash.size(); i++) {
+            if (!isActive(array_hash, i)) continue;
+            int probes = 1;
+            int collisionNum = 0;
+            size_t currentPos = array_hash[i].element->hash % array_hash.size();
+            while (currentPos != i) {
+                ++collisionNum;
+                currentPos = (currentPos + static_cast<size_t>(collisionNum) * collisionNum) % array_hash.size();
+                probes++;
+            }
+            total += probes;
+            active++;
+            longest = max(longest, probes);
+        }
+        average = active > 0 ? static_cast<double>(total) / active : 0.0;
+    }
+
+    int getTableSize() const {
+        return array_hash.size();
+    }
+
+    // bytes held by the slot arrays and nodes, without the words' own heap storage and the postings
+    size_t memoryUsage() const {
+        return (array_hash.size() + old_hash.size()) * sizeof(HashEntry)
+            + uniqueWordCount * sizeof(typename remove_pointer<HashedObj>::type);
+    }
+
+    bool isMigrating() const {
+        return !old_hash.empty();
+    }
+
+    // visits every stored node, in no particular order
+    template<class Visitor>
+    void forEach(Visitor visit) const {
+        for (size_t i = 0; i < array_hash.size(); i++)
+            if (isActive(array_hash, i)) visit(array_hash[i].element);
+        for (size_t i = 0; i < old_hash.size(); i++)
+            if (isActive(old_hash, i)) visit(old_hash[i].element);
+    }
+
+private:
+    struct HashEntry {
+        HashedObj element;
+        EntryType info;
+    };
+
+    // slot storage comes from calloc, so a new table reads as all EMPTY without a pass over it
+    // and the kernel hands out the zeroed pages lazily as the migration reaches them
+    class EntryArray {
+    public:
+        EntryArray() : slots(nullptr), count(0) {}
+        ~EntryArray() { free(slots); }
+        EntryArray(const EntryArray&) = delete;
+        EntryArray& operator=(const EntryArray&) = delete;
+
+        void assign(size_t n) {
+            free(slots);
+            slots = static_cast<HashEntry*>(calloc(n, sizeof(HashEntry)));
+            if (slots == nullptr) throw bad_alloc();
+            count = n;
+        }
+        void release() {
+            free(slots);
+            slots = nullptr;
+            count = 0;
+        }
+        void swap(EntryArray& other) {
+            std::swap(slots, other.slots);
+            std::swap(count, other.count);
+        }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        HashEntry& operator[](size_t i) { return slots[i]; }
+        const HashEntry& operator[](size_t i) const { return slots[i]; }
+        HashEntry* begin() { return slots; }
+        HashEntry* end() { return slots + count; }
+
+    private:
+        HashEntry* slots;
+        size_t count;
+    };
+
+    // number of old slots moved per insert while migrating. A growing table doubles and a
+    // compacted one starts at most half full, so the old one is drained long before the new
+    // one fills up.
+    static constexpr size_t MIGRATE_STEP = 16;
+
+    EntryArray array_hash;
+    EntryArray old_hash;
+    size_t migratePos;
+    int uniqueWordCount;
+    int tombstoneCount;  // DELETED slots of array_hash; the old table's go away with it
+    RehashMode mode;
+
+    static bool isActive(const EntryArray& table, int currentPos) {
+        return table[currentPos].info == ACTIVE;
+    }
+
+    // share of the current table's slots that are not EMPTY, and so lengthen probe chains
+    float fill() const {
+        return static_cast<float>(uniqueWordCount + tombstoneCount) / array_hash.size();
+    }
+
+    // The cached hash rejects almost every mismatch before the string compare. When x is absent
+    // deletedPos, if given, receives the first tombstone on its chain (or -1), where x can go.
+    static int findPos(const EntryArray& table, const Key& x, uint64_t hash, int* deletedPos = nullptr) {
+        int collisionNum = 0;
+        int currentPos = hash % table.size();
+        if (deletedPos) *deletedPos = -1;
+        while (table[currentPos].info != EMPTY &&
+            (table[currentPos].info == DELETED || table[currentPos].element->hash != hash ||
+                table[currentPos].element->word != x)) {
+            if (deletedPos && *deletedPos < 0 && table[currentPos].info == DELETED) *deletedPos = currentPos;
+            currentPos += ++collisionNum * collisionNum;
+            currentPos %= table.size();
+        }
+        return currentPos;
+    }
+
+    // stores node in the free slot findPos returned, reusing the tombstone on the way if there was one
+    void place(EntryArray& table, int emptyPos, int deletedPos, HashedObj node) {
+        int currentPos = emptyPos;
+        if (deletedPos >= 0) {
+            currentPos = deletedPos;
+            tombstoneCount--;
+        }
+        table[currentPos].element = node;
+        table[currentPos].info = ACTIVE;
+    }
+
+    // places an already allocated node into the current table, the word is known to be absent
+    void moveIn(HashedObj node) {
+        int deletedPos;
+        int currentPos = findPos(array_hash, node->word, node->hash, &deletedPos);
+        place(array_hash, currentPos, deletedPos, node);
+    }
+
+    bool removeOne(const Key& x) {
+        uint64_t hash = word_hash(x);
+        int currentPos = findPos(array_hash, x, hash);
+        if (isActive(array_hash, currentPos)) {
+            delete array_hash[currentPos].element;
+            array_hash[currentPos].element = nullptr;
+            array_hash[currentPos].info = DELETED;
+            tombstoneCount++;
+            uniqueWordCount--;
+            return true;
+        }
+        if (isMigrating()) {
+            currentPos = findPos(old_hash, x, hash);
+            if (isActive(old_hash, currentPos)) {
+                delete old_hash[currentPos].element;
+                old_hash[currentPos].element = nullptr;
+                old_hash[currentPos].info = DELETED;
+                uniqueWordCount--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Rebuilds the table once a quarter of it is tombstones, which every lookup of a missing word
+    // has to walk past. It shrinks to half when the live words would fill less than an eighth.
+    void compactIfSparse() {
+        size_t size = array_hash.size();
+        if (static_cast<size_t>(tombstoneCount) * 4 <= size) return;
+        rehash(size > 53 && static_cast<size_t>(uniqueWordCount) * 8 < size ? nextPrime(size / 2) : size);
+    }
+
+    void migrateStep() {
+        size_t stop = min(old_hash.size(), migratePos + MIGRATE_STEP);
+        for (; migratePos < stop; migratePos++) {
+            HashEntry& entry = old_hash[migratePos];
+            if (entry.info == ACTIVE) {
+                moveIn(entry.element);
+                entry.element = nullptr;
+                // a tombstone keeps probe chains intact for words not moved yet
+                entry.info = DELETED;
+            }
+        }
+        if (migratePos == old_hash.size()) {
+            old_hash.release();
+            migratePos = 0;
+        }
+    }
+
+    // Moves the existing node pointers into a fresh table of the given size, leaving every
+    // tombstone behind; nodes are never copied or reallocated, except by REPLAY.
+    void rehash(size_t size) {
+        if (isMigrating()) {
+            // a resize is already in progress, finish it before starting the next one
+            while (isMigrating()) migrateStep();
+        }
+        if (mode == REPLAY) {
+            EntryArray replayed;
+            replayed.swap(array_hash);
+            array_hash.assign(size);
+            uniqueWordCount = 0;
+            tombstoneCount = 0;
+            for (auto& entry : replayed) {
+                if (entry.info != ACTIVE) continue;
+                insert(entry.element->word, entry.element->term);
+                delete entry.element;
+            }
+            return;
+        }
+        old_hash.swap(array_hash);
+        array_hash.assign(size);
+        tombstoneCount = 0;
+        migratePos = 0;
+        if (mode == STOP_THE_WORLD) {
+            while (isMigrating()) migrateStep();
+        }
+    }
+};
+
+struct FlatEntry {
+    string_view word;  // letters owned by the inserter, like HashNode's
+    uint32_t term = 0;
+};
+
+// Open addressing table in the style of Swiss tables: one control byte per slot holds either
+// EMPTY, DELETED or the low 7 bits of the word's hash, and a probe checks 16 control bytes at
+// once. Entries live inline in the slot array, so a lookup only touches a slot whose tag matched.
+class FlatTable {
+public:
+    FlatTable() : entryCount(0), tombstoneCount(0) {
+        allocate(GROUP_WIDTH * 4);
+    }
+
+    const FlatEntry* find(string_view word) const {
+        size_t pos = findSlot(word, hashOf(word));
+        return pos == NOT_FOUND ? nullptr : &slots[pos];
+    }
+
+    // adds word under term unless it is there already
+    void insert(string_view word, uint32_t term) {
+        uint64_t hash = hashOf(word);
+        if (findSlot(word, hash) != NOT_FOUND) return;
+        if ((entryCount + tombstoneCount + 1) * 8 > slots.size() * 7) {
+            rehash(entryCount * 2 + 1 > slots.size() / 2 ? slots.size() * 2 : slots.size());
+        }
+        size_t pos = findFreeSlot(hash);
+        if (ctrl[pos] == CTRL_DELETED) tombstoneCount--;
+        ctrl[pos] = tagOf(hash);
+        slots[pos].word = word;
+        slots[pos].term = term;
+        entryCount++;
+    }
+
+    void remove(string_view word) {
+        size_t pos = findSlot(word, hashOf(word));
+        if (pos == NOT_FOUND) return;
+        ctrl[pos] = CTRL_DELETED;
+        slots[pos] = FlatEntry();
+        entryCount--;
+        tombstoneCount++;
+    }
+
+    int getUniqueWordCount() const {
+        return entryCount;
+    }
+
+    float loadFactor() const {
+        return static_cast<float>(entryCount) / slots.size();
+    }
+
+    template<class Visitor>
+    void forEach(Visitor visit) const {
+        for (size_t i = 0; i < slots.size(); i++)
+            if (ctrl[i] >= 0) visit(slots[i]);
+    }
+
+private:
+    static constexpr size_t GROUP_WIDTH = 16;
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+    static constexpr int8_t CTRL_EMPTY = -128;
+    static constexpr int8_t CTRL_DELETED = -2;
+
+    vector<int8_t> ctrl;
+    vector<FlatEntry> slots;
+    size_t groupMask;
+    size_t entryCount;
+    size_t tombstoneCount;
+
+    static uint64_t hashOf(string_view word) {
+        return word_hash(word);
+    }
+
+    static int8_t tagOf(uint64_t hash) {
+        return static_cast<int8_t>(hash & 0x7F);
+    }
+
+    // bit i is set when control byte i of the group equals tag
+    static uint32_t matchTag(const int8_t* group, int8_t tag) {
+#ifdef HAVE_SSE2
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; i++)
+            if (group[i] == tag) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    // EMPTY and DELETED are the only negative control bytes, so the sign bits mark free slots
+    static uint32_t matchFree(const int8_t* group) {
+#ifdef HAVE_SSE2
+        return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; i++)
+            if (group[i] < 0) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    void allocate(size_t capacity) {
+        ctrl.assign(capacity, CTRL_EMPTY);
+        slots.clear();
+        slots.resize(capacity);
+        groupMask = capacity / GROUP_WIDTH - 1;
+        tombstoneCount = 0;
+    }
+
+    // groups are probed triangularly (g, g+1, g+3, g+6, ...), which visits every group of a
+    // power of two table
+    size_t findSlot(string_view word, uint64_t hash) const {
+        int8_t tag = tagOf(hash);
+        size_t group = (hash >> 7) & groupMask;
+        for (size_t step = 1; ; step++) {
+            const int8_t* bytes = &ctrl[group * GROUP_WIDTH];
+            for (uint32_t mask = matchTag(bytes, tag); mask != 0; mask &= mask - 1) {
+                size_t pos = group * GROUP_WIDTH + countTrailingZeros(mask);
+                if (slots[pos].word == word) return pos;
+            }
+            if (matchTag(bytes, CTRL_EMPTY) != 0) return NOT_FOUND;
+            group = (group + step) & groupMask;
+        }
+    }
+
+    size_t findFreeSlot(uint64_t hash) const {
+        size_t group = (hash >> 7) & groupMask;
+        for (size_t step = 1; ; step++) {
+            uint32_t mask = matchFree(&ctrl[group * GROUP_WIDTH]);
+            if (mask != 0) return group * GROUP_WIDTH + countTrailingZeros(mask);
+            group = (group + step) & groupMask;
+        }
+    }
+
+    void rehash(size_t capacity) {
+        vector<int8_t> oldCtrl;
+        vector<FlatEntry> oldSlots;
+        oldCtrl.swap(ctrl);
+        oldSlots.swap(slots);
+        allocate(capacity);
+        for (size_t i = 0; i < oldSlots.size(); i++) {
+            if (oldCtrl[i] < 0) continue;
+            uint64_t hash = hashOf(oldSlots[i].word);
+            size_t pos = findFreeSlot(hash);
+            ctrl[pos] = tagOf(hash);
+            slots[pos] = std::move(oldSlots[i]);
+        }
+    }
+};
+
+// bytes of the process currently held in memory, 0 where the platform does not tell
+size_t residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return counters.WorkingSetSize;
+    return 0;
+#else
+    ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    if (!(statm >> totalPages >> residentPages)) return 0;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Read-only view of a whole file through a memory mapping. Nothing is copied into the process
+// and the file on disk is never modified.
+class MappedFile {
+public:
+    explicit MappedFile(const string& filename) : data(nullptr), length(0), opened(false) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+            if (data != nullptr) {
+                length = static_cast<size_t>(size.QuadPart);
+                opened = true;
+            }
+        }
+        else if (size.QuadPart == 0) {
+            opened = true;
+        }
+        CloseHandle(file);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(mapped);
+                length = info.st_size;
+                opened = true;
+            }
+        }
+        else if (fstat(fd, &info) == 0) {
+            opened = true;
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+        if (data == nullptr) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<char*>(data), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const {
+        return opened;
+    }
+
+    string_view contents() const {
+        return string_view(data, length);
+    }
+
+private:
+    const char* data;
+    size_t length;
+    bool opened;
+};
+
+inline bool isAsciiAlpha(unsigned char c) {
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+}
+
+// bit i is set when text[i] is an ASCII letter; folding in 0x20 maps upper case onto lower
+// case, so one unsigned range check covers both
+inline uint32_t alphaMask16(const char* text) {
+#ifdef HAVE_SSE2
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+    __m128i offset = _mm_sub_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(25)), offset);
+    return _mm_movemask_epi8(inRange);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; i++)
+        if (isAsciiAlpha(text[i])) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+// Calls onToken with a view of every maximal run of ASCII letters in text. Letters are
+// classified 16 bytes at a time and token boundaries are read off the resulting bit mask.
+template<class Callback>
+void forEachToken(string_view text, Callback onToken) {
+    const char* data = text.data();
+    size_t length = text.size();
+    bool inToken = false;
+    size_t tokenStart = 0;
+    for (size_t base = 0; base < length; base += 16) {
+        uint32_t alpha, valid = 0xFFFF;
+        if (base + 16 <= length) {
+            alpha = alphaMask16(data + base);
+        }
+        else {
+            alpha = 0;
+            valid = (1u << (length - base)) - 1;
+            for (size_t i = base; i < length; i++)
+                if (isAsciiAlpha(data[i])) alpha |= 1u << (i - base);
+        }
+        int bit = 0;
+        while (true) {
+            if (inToken) {
+                uint32_t boundary = ~alpha & valid & (0xFFFFu << bit);
+                if (boundary == 0) break;
+                bit = countTrailingZeros(boundary);
+                onToken(string_view(data + tokenStart, base + bit - tokenStart));
+                inToken = false;
+            }
+            else {
+                uint32_t letters = alpha & (0xFFFFu << bit);
+                if (letters == 0) break;
+                bit = countTrailingZeros(letters);
+                tokenStart = base + bit;
+                inToken = true;
+            }
+        }
+    }
+    if (inToken) {
+        onToken(string_view(data + tokenStart, length - tokenStart));
+    }
+}
+
+inline void writeVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint32_t readVarint(const uint8_t*& p) {
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *p++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+// Optional index of token offsets. Each word owns one byte stream with an entry per document:
+//   varint documentDelta, varint frequency, varint positionBytes, frequency varint positionDeltas
+// positionBytes lets a cursor step over a document without decoding its positions, so a phrase
+// query only decodes positions for documents that contain every word.
+class PositionalIndex {
+public:
+    // positions must arrive in increasing document order, and in increasing order within a document;
+    // word is kept as a view, so it must be the TermStore's copy
+    void add(string_view word, uint32_t documentId, uint32_t position) {
+        auto it = termIds.find(word);
+        if (it == termIds.end()) {
+            it = termIds.emplace(word, static_cast<uint32_t>(terms.size())).first;
+            terms.emplace_back();
+        }
+        TermPostings& term = terms[it->second];
+        if (term.pending.empty()) {
+            touched.push_back(it->second);
+            term.pendingDocument = documentId;
+        }
+        term.pending.push_back(position);
+    }
+
+    // encodes the positions collected for the current document
+    void finishDocument() {
+        for (uint32_t id : touched) flush(terms[id]);
+        touched.clear();
+    }
+
+    size_t sizeInBytes() const {
+        size_t bytes = 0;
+        for (const auto& term : terms) bytes += term.bytes.size();
+        return bytes;
+    }
+
+    // appends other, whose documents all come after the ones already stored; stored(word) gives
+    // the copy of each of other's words that lives as long as this index
+    template<class Stored>
+    void merge(const PositionalIndex& other, Stored stored) {
+        for (const auto& entry : other.termIds) {
+            const TermPostings& source = other.terms[entry.second];
+            if (source.bytes.empty()) continue;
+            auto it = termIds.find(entry.first);
+            if (it == termIds.end()) {
+                it = termIds.emplace(stored(entry.first), static_cast<uint32_t>(terms.size())).first;
+                terms.emplace_back();
+            }
+            TermPostings& target = terms[it->second];
+            // only the first delta of the appended stream changes, it becomes relative to our last document
+            const uint8_t* p = source.bytes.data();
+            uint32_t firstDocument = readVarint(p);
+            writeVarint(target.bytes, target.bytes.empty() ? firstDocument : firstDocument - target.lastDocument);
+            target.bytes.insert(target.bytes.end(), p, source.bytes.data() + source.bytes.size());
+            target.lastDocument = source.lastDocument;
+        }
+    }
+
+    // Documents in which the words occur in order with at most slop extra tokens between the
+    // first and the last one (slop 0 is an exact phrase), with the number of such occurrences.
+    vector<DocumentItem> phraseQuery(const vector<string>& words, int slop = 0) const {
+        vector<DocumentItem> results;
+        vector<Cursor> cursors;
+        for (const auto& word : words) {
+            auto it = termIds.find(word);
+            if (it == termIds.end()) return results;
+            cursors.emplace_back(terms[it->second].bytes);
+        }
+        if (cursors.empty()) return results;
+
+        vector<vector<uint32_t>> positions(cursors.size());
+        while (true) {
+            uint32_t target = 0;
+            for (auto& cursor : cursors) {
+                if (!cursor.valid()) return results;
+                target = max(target, cursor.document());
+            }
+            bool aligned = true;
+            for (auto& cursor : cursors) {
+                if (!cursor.advanceTo(target)) return results;
+                if (cursor.document() != target) aligned = false;
+            }
+            if (!aligned) continue;
+
+            for (size_t i = 0; i < cursors.size(); i++) cursors[i].decodePositions(positions[i]);
+            int matches = countMatches(positions, cursors.size() - 1 + slop);
+            if (matches > 0) results.push_back({ target, matches });
+            cursors[0].next();
+        }
+    }
+
+private:
+    struct TermPostings {
+        vector<uint8_t> bytes;
+        uint32_t lastDocument = 0;
+        uint32_t pendingDocument = 0;
+        vector<uint32_t> pending;
+    };
+
+    // walks one word's stream; positions of a document are decoded only on request
+    class Cursor {
+    public:
+        explicit Cursor(const vector<uint8_t>& bytes)
+            : p(bytes.data()), end(bytes.data() + bytes.size()), documentId(0), frequency(0),
+              positions(nullptr), isValid(true) {
+            next();
+        }
+
+        bool valid() const { return isValid; }
+        uint32_t document() const { return documentId; }
+
+        bool next() {
+            if (p == end) return isValid = false;
+            documentId += readVarint(p);
+            frequency = readVarint(p);
+            uint32_t positionBytes = readVarint(p);
+            positions = p;
+            p += positionBytes;
+            return true;
+        }
+
+        bool advanceTo(uint32_t target) {
+            while (isValid && documentId < target) next();
+            return isValid;
+        }
+
+        void decodePositions(vector<uint32_t>& out) const {
+            out.clear();
+            const uint8_t* q = positions;
+            uint32_t position = 0;
+            for (uint32_t i = 0; i < frequency; i++) {
+                position += readVarint(q);
+                out.push_back(position);
+            }
+        }
+
+    private:
+        const uint8_t* p;
+        const uint8_t* end;
+        uint32_t documentId;
+        uint32_t frequency;
+        const uint8_t* positions;
+        bool isValid;
+    };
+
+    // views of the index's TermStore letters; the streams stay here, as they hold positions
+    // rather than the store's (document, count) postings
+    unordered_map<string_view, uint32_t> termIds;
+    vector<TermPostings> terms;
+    vector<uint32_t> touched;
+    vector<uint8_t> scratch;
+
+    void flush(TermPostings& term) {
+        scratch.clear();
+        uint32_t previous = 0;
+        for (uint32_t position : term.pending) {
+            writeVarint(scratch, position - previous);
+            previous = position;
+        }
+        bool first = term.bytes.empty();
+        writeVarint(term.bytes, first ? term.pendingDocument : term.pendingDocument - term.lastDocument);
+        writeVarint(term.bytes, term.pending.size());
+        writeVarint(term.bytes, scratch.size());
+        term.bytes.insert(term.bytes.end(), scratch.begin(), scratch.end());
+        term.lastDocument = term.pendingDocument;
+        term.pending.clear();
+    }
+
+    // For every position of the first word, picks the earliest later position of each following
+    // word; that choice minimizes the span, so the start matches iff that span fits the window.
+    static int countMatches(const vector<vector<uint32_t>>& positions, size_t maxSpan) {
+        int matches = 0;
+        for (uint32_t start : positions[0]) {
+            uint32_t previous = start;
+            bool found = true;
+            for (size_t i = 1; i < positions.size() && found; i++) {
+                auto next = upper_bound(positions[i].begin(), positions[i].end(), previous);
+                if (next == positions[i].end() || *next - start > maxSpan) found = false;
+                else previous = *next;
+            }
+            if (found) matches++;
+        }
+        return matches;
+    }
+};
+
+// Read-only copy of the finished AVL tree laid out for the cache. The words are kept in
+// Eytzinger (breadth-first) order as their first 8 bytes packed big-endian, so the search is a
+// branch-free descent over one array whose next levels can be prefetched; full words are only
+// compared when two prefixes are equal. Words and postings are copied into pooled arrays in
+// sorted order, so the dictionary stands on its own once frozen.
+class FrozenDictionary {
+public:
+    template<class Tree>
+    void freeze(const Tree& tree, const TermStore& terms) {
+        vector<const WordItem*> sorted;
+        tree.forEach([&](const WordItem* node) { sorted.push_back(node); });
+        count = static_cast<uint32_t>(sorted.size());
+
+        pool.clear();
+        postings.clear();
+        wordStarts.assign(1, 0);
+        postingStarts.assign(1, 0);
+        for (const WordItem* node : sorted) {
+            pool += node->word;
+            const vector<DocumentItem>& details = terms.postings(node->term);
+            postings.insert(postings.end(), details.begin(), details.end());
+            wordStarts.push_back(static_cast<uint32_t>(pool.size()));
+            postingStarts.push_back(static_cast<uint32_t>(postings.size()));
+        }
+
+        // slot 0 is unused so that the children of slot k are 2k and 2k + 1
+        prefixes.assign(count + 1, 0);
+        ranks.assign(count + 1, 0);
+        uint32_t next = 0;
+        place(1, next);
+    }
+
+    bool find(string_view word, PostingSpan& span) const {
+        uint32_t slot = lowerBound(word);
+        if (slot == 0) return false;
+        uint32_t rank = ranks[slot];
+        if (wordAt(rank) != word) return false;
+        span = PostingSpan{ postings.data() + postingStarts[rank], postingStarts[rank + 1] - postingStarts[rank] };
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    static uint64_t prefixOf(string_view word) {
+        uint64_t prefix = 0;
+        size_t length = min<size_t>(word.size(), 8);
+        for (size_t i = 0; i < length; i++) prefix |= static_cast<uint64_t>(static_cast<unsigned char>(word[i])) << (56 - 8 * i);
+        return prefix;
+    }
+
+    string_view wordAt(uint32_t rank) const {
+        return string_view(pool.data() + wordStarts[rank], wordStarts[rank + 1] - wordStarts[rank]);
+    }
+
+    // in-order walk of the implicit tree hands out the sorted ranks
+    void place(uint32_t slot, uint32_t& next) {
+        if (slot > count) return;
+        place(2 * slot, next);
+        ranks[slot] = next;
+        prefixes[slot] = prefixOf(wordAt(next));
+        next++;
+        place(2 * slot + 1, next);
+    }
+
+    // slot of the first word not less than the query, 0 if every word is smaller
+    uint32_t lowerBound(string_view word) const {
+        uint64_t key = prefixOf(word);
+        bool longWord = word.size() > 8;
+        uint32_t slot = 1;
+        while (slot <= count) {
+#ifdef HAVE_SSE2
+            // the 8 descendants three levels down are contiguous
+            _mm_prefetch(reinterpret_cast<const char*>(prefixes.data()) + 64 * static_cast<size_t>(slot), _MM_HINT_T0);
+#endif
+            uint64_t prefix = prefixes[slot];
+            bool less = prefix < key;
+            // words of up to 8 letters are told apart by the prefix alone
+            if (prefix == key && longWord) less = wordAt(ranks[slot]) < word;
+            slot = 2 * slot + less;
+        }
+        // drop the trailing right turns and the final left turn
+        return slot >> (countTrailingZeros(~slot) + 1);
+    }
+
+    uint32_t count = 0;
+    vector<uint64_t> prefixes;
+    vector<uint32_t> ranks;
+    string pool;
+    vector<uint32_t> wordStarts;
+    vector<DocumentItem> postings;
+    vector<uint32_t> postingStarts;
+};
+
+// Adaptive radix tree over lower case words. An inner node branches on one byte and comes in
+// four sizes: Node4 and Node16 keep sorted key arrays, Node48 maps all 256 bytes to 48 child
+// slots and Node256 indexes its children directly; a node moves to the next size up or down as
+// children come and go. Chains of single child nodes are collapsed into a prefix on the node
+// below, of which the first 8 bytes are stored and the rest is read back from a leaf. Leaves are
+// a TermEntry of the TermStore given at construction, told apart by the low pointer bit, and
+// every word ends in an implicit 0 byte so that no word is a prefix of another.
+class AdaptiveRadixTree {
+public:
+    explicit AdaptiveRadixTree(TermStore& terms) : terms(terms) {}
+    AdaptiveRadixTree(const AdaptiveRadixTree&) = delete;
+    AdaptiveRadixTree& operator=(const AdaptiveRadixTree&) = delete;
+
+    ~AdaptiveRadixTree() {
+        makeEmpty();
+    }
+
+    void insert(string_view key) {
+        upsert(key);
+    }
+
+    // finds the entry of a lower case key, inserting it first if it is missing
+    TermEntry* upsert(string_view key) {
+        TermEntry* entry = nullptr;
+        insert(root, key, 0, entry);
+        return entry;
+    }
+
+    TermEntry* find(string_view key) const {
+        string buffer;
+        key = lowerKey(key, buffer);
+        Node* node = root;
+        size_t depth = 0;
+        while (node != nullptr) {
+            if (isLeaf(node)) {
+                TermEntry* entry = asLeaf(node);
+                return entry->word == key ? entry : nullptr;
+            }
+            if (node->prefixLength != 0) {
+                // bytes past the stored ones are skipped, the leaf's full compare catches them
+                size_t stored = min<size_t>(node->prefixLength, MAX_PREFIX);
+                for (size_t i = 0; i < stored; i++)
+                    if (node->prefix[i] != keyByte(key, depth + i)) return nullptr;
+                depth += node->prefixLength;
+                if (depth > key.size()) return nullptr;
+            }
+            Node** child = findChild(node, keyByte(key, depth));
+            node = child ? *child : nullptr;
+            depth++;
+        }
+        return nullptr;
+    }
+
+    void remove(string_view key) {
+        string buffer;
+        key = lowerKey(key, buffer);
+        remove(root, key, 0);
+    }
+
+    void makeEmpty() {
+        destroy(root);
+        root = nullptr;
+    }
+
+    bool isEmpty() const {
+        return root == nullptr;
+    }
+
+    size_t size() const {
+        return leafCount;
+    }
+
+    // bytes held by inner nodes and entries, the words and postings are in the TermStore
+    size_t memoryUsage() const {
+        return nodeBytes + leafCount * sizeof(TermEntry);
+    }
+
+    // visits every entry in word order
+    template<class Visitor>
+    void forEach(Visitor visit) const {
+        forEach(root, visit);
+    }
+
+private:
+    static constexpr size_t MAX_PREFIX = 8;
+
+    enum NodeType : uint8_t { NODE4, NODE16, NODE48, NODE256 };
+
+    struct Node {
+        NodeType type;
+        uint16_t count = 0;
+        uint32_t prefixLength = 0;
+        uint8_t prefix[MAX_PREFIX];
+
+        explicit Node(NodeType type) : type(type) {}
+    };
+
+    struct Node4 : Node {
+        uint8_t keys[4] = {};
+        Node* children[4] = {};
+        Node4() : Node(NODE4) {}
+    };
+
+    struct Node16 : Node {
+        uint8_t keys[16] = {};
+        Node* children[16] = {};
+        Node16() : Node(NODE16) {}
+    };
+
+    // childIndex holds slot + 1 of each byte's child, 0 when there is none
+    struct Node48 : Node {
+        uint8_t childIndex[256] = {};
+        Node* children[48] = {};
+        Node48() : Node(NODE48) {}
+    };
+
+    struct Node256 : Node {
+        Node* children[256] = {};
+        Node256() : Node(NODE256) {}
+    };
+
+    // a removed word's term stays in the store, which never gives words back
+    TermStore& terms;
+    Node* root = nullptr;
+    size_t nodeBytes = 0;
+    size_t leafCount = 0;
+
+    static bool isLeaf(const Node* node) {
+        return reinterpret_cast<uintptr_t>(node) & 1;
+    }
+
+    static TermEntry* asLeaf(const Node* node) {
+        return reinterpret_cast<TermEntry*>(reinterpret_cast<uintptr_t>(node) & ~static_cast<uintptr_t>(1));
+    }
+
+    // the implicit terminator reads as 0, which no letter does
+    static uint8_t keyByte(string_view key, size_t depth) {
+        return depth < key.size() ? static_cast<uint8_t>(key[depth]) : 0;
+    }
+
+    Node* newLeaf(string_view key, TermEntry*& entry) {
+        uint32_t term = terms.add(key);
+        entry = new TermEntry{ terms.word(term), term };
+        leafCount++;
+        return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(entry) | 1);
+    }
+
+    template<class T>
+    T* create() {
+        nodeBytes += sizeof(T);
+        return new T();
+    }
+
+    template<class T>
+    void release(T* node) {
+        nodeBytes -= sizeof(T);
+        delete node;
+    }
+
+    void release(Node* node) {
+        switch (node->type) {
+        case NODE4: release(static_cast<Node4*>(node)); break;
+        case NODE16: release(static_cast<Node16*>(node)); break;
+        case NODE48: release(static_cast<Node48*>(node)); break;
+        case NODE256: release(static_cast<Node256*>(node)); break;
+        }
+    }
+
+    static void copyHeader(Node* to, const Node* from) {
+        to->count = from->count;
+        to->prefixLength = from->prefixLength;
+        memcpy(to->prefix, from->prefix, MAX_PREFIX);
+    }
+
+    // calls visit on each child slot in byte order
+    template<class Visitor>
+    static void forEachChild(Node* node, Visitor& visit) {
+        switch (node->type) {
+        case NODE4: {
+            Node4* n = static_cast<Node4*>(node);
+            for (int i = 0; i < n->count; i++) visit(n->children[i]);
+            break;
+        }
+        case NODE16: {
+            Node16* n = static_cast<Node16*>(node);
+            for (int i = 0; i < n->count; i++) visit(n->children[i]);
+            break;
+        }
+        case NODE48: {
+            Node48* n = static_cast<Node48*>(node);
+            for (int byte = 0; byte < 256; byte++)
+                if (n->childIndex[byte] != 0) visit(n->children[n->childIndex[byte] - 1]);
+            break;
+        }
+        case NODE256: {
+            Node256* n = static_cast<Node256*>(node);
+            for (int byte = 0; byte < 256; byte++)
+                if (n->children[byte] != nullptr) visit(n->children[byte]);
+            break;
+        }
+        }
+    }
+
+    Node** findChild(Node* node, uint8_t byte) const {
+        switch (node->type) {
+        case NODE4: {
+            Node4* n = static_cast<Node4*>(node);
+            for (int i = 0; i < n->count; i++)
+                if (n->keys[i] == byte) return &n->children[i];
+            return nullptr;
+        }
+        case NODE16: {
+            Node16* n = static_cast<Node16*>(node);
+#ifdef HAVE_SSE2
+            __m128i keys = _mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys));
+            uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8(static_cast<char>(byte))));
+            mask &= (1u << n->count) - 1;
+            return mask != 0 ? &n->children[countTrailingZeros(mask)] : nullptr;
+#else
+            for (int i = 0; i < n->count; i++)
+                if (n->keys[i] == byte) return &n->children[i];
+            return nullptr;
+#endif
+        }
+        case NODE48: {
+            Node48* n = static_cast<Node48*>(node);
+            return n->childIndex[byte] != 0 ? &n->children[n->childIndex[byte] - 1] : nullptr;
+        }
+        case NODE256: {
+            Node256* n = static_cast<Node256*>(node);
+            return n->children[byte] != nullptr ? &n->children[byte] : nullptr;
+        }
+        }
+        return nullptr;
+    }
+
+    // the smallest word below node; all of them share the node's prefix
+    static TermEntry* minimumLeaf(Node* node) {
+        while (!isLeaf(node)) {
+            switch (node->type) {
+            case NODE4: node = static_cast<Node4*>(node)->children[0]; break;
+            case NODE16: node = static_cast<Node16*>(node)->children[0]; break;
+            case NODE48: {
+                Node48* n = static_cast<Node48*>(node);
+                int byte = 0;
+                while (n->childIndex[byte] == 0) byte++;
+                node = n->children[n->childIndex[byte] - 1];
+                break;
+            }
+            case NODE256: {
+                Node256* n = static_cast<Node256*>(node);
+                int byte = 0;
+                while (n->children[byte] == nullptr) byte++;
+                node = n->children[byte];
+                break;
+            }
+            }
+        }
+        return asLeaf(node);
+    }
+
+    // number of leading prefix bytes of node that match key from depth on
+    static size_t prefixMismatch(Node* node, string_view key, size_t depth) {
+        size_t stored = min<size_t>(node->prefixLength, MAX_PREFIX);
+        size_t i = 0;
+        for (; i < stored; i++)
+            if (node->prefix[i] != keyByte(key, depth + i)) return i;
+        if (node->prefixLength > MAX_PREFIX) {
+            string_view word = minimumLeaf(node)->word;
+            for (; i < node->prefixLength; i++)
+                if (keyByte(word, depth + i) != keyByte(key, depth + i)) return i;
+        }
+        return i;
+    }
+
+    template<size_t N>
+    static void insertSorted(uint8_t (&keys)[N], Node* (&children)[N], uint16_t& count, uint8_t byte, Node* child) {
+        int pos = count;
+        for (; pos > 0 && keys[pos - 1] > byte; pos--) {
+            keys[pos] = keys[pos - 1];
+            children[pos] = children[pos - 1];
+        }
+        keys[pos] = byte;
+        children[pos] = child;
+        count++;
+    }
+
+    // adds a child under a byte the node does not have yet, growing the node when it is full
+    void addChild(Node*& ref, uint8_t byte, Node* child) {
+        Node* node = ref;
+        switch (node->type) {
+        case NODE4: {
+            Node4* n = static_cast<Node4*>(node);
+            if (n->count < 4) {
+                insertSorted(n->keys, n->children, n->count, byte, child);
+                return;
+            }
+            Node16* grown = create<Node16>();
+            copyHeader(grown, n);
+            memcpy(grown->keys, n->keys, sizeof(n->keys));
+            memcpy(grown->children, n->children, sizeof(n->children));
+            insertSorted(grown->keys, grown->children, grown->count, byte, child);
+            release(n);
+            ref = grown;
+            return;
+        }
+        case NODE16: {
+            Node16* n = static_cast<Node16*>(node);
+            if (n->count < 16) {
+                insertSorted(n->keys, n->children, n->count, byte, child);
+                return;
+            }
+            Node48* grown = create<Node48>();
+            copyHeader(grown, n);
+            for (int i = 0; i < 16; i++) {
+                grown->childIndex[n->keys[i]] = static_cast<uint8_t>(i + 1);
+                grown->children[i] = n->children[i];
+            }
+            release(n);
+            ref = grown;
+            addChild(ref, byte, child);
+            return;
+        }
+        case NODE48: {
+            Node48* n = static_cast<Node48*>(node);
+            if (n->count < 48) {
+                int slot = 0;
+                while (n->children[slot] != nullptr) slot++;
+                n->children[slot] = child;
+                n->childIndex[byte] = static_cast<uint8_t>(slot + 1);
+                n->count++;
+                return;
+            }
+            Node256* grown = create<Node256>();
+            copyHeader(grown, n);
+            for (int b = 0; b < 256; b++)
+                if (n->childIndex[b] != 0) grown->children[b] = n->children[n->childIndex[b] - 1];
+            release(n);
+            ref = grown;
+            addChild(ref, byte, child);
+            return;
+        }
+        case NODE256: {
+            Node256* n = static_cast<Node256*>(node);
+            n->children[byte] = child;
+            n->count++;
+            return;
+        }
+        }
+    }
+
+    // Takes the child in slot (under byte) out of the node, shrinking the node once it is well
+    // below its size, so a node never flips back and forth on one insert and remove. A Node4
+    // left with one child is replaced by that child, which takes over the node's prefix.
+    void removeChild(Node*& ref, uint8_t byte, Node** slot) {
+        Node* node = ref;
+        switch (node->type) {
+        case NODE4: {
+            Node4* n = static_cast<Node4*>(node);
+            int pos = static_cast<int>(slot - n->children);
+            for (int i = pos + 1; i < n->count; i++) {
+                n->keys[i - 1] = n->keys[i];
+                n->children[i - 1] = n->children[i];
+            }
+            n->count--;
+            if (n->count > 1) return;
+            Node* child = n->children[0];
+            if (!isLeaf(child)) {
+                uint32_t length = n->prefixLength;
+                if (length < MAX_PREFIX) n->prefix[length++] = n->keys[0];
+                if (length < MAX_PREFIX) {
+                    size_t copied = min<size_t>(child->prefixLength, MAX_PREFIX - length);
+                    memcpy(n->prefix + length, child->prefix, copied);
+                    length += copied;
+                }
+                memcpy(child->prefix, n->prefix, min<size_t>(length, MAX_PREFIX));
+                child->prefixLength += n->prefixLength + 1;
+            }
+            release(n);
+            ref = child;
+            return;
+        }
+        case NODE16: {
+            Node16* n = static_cast<Node16*>(node);
+            int pos = static_cast<int>(slot - n->children);
+            for (int i = pos + 1; i < n->count; i++) {
+                n->keys[i - 1] = n->keys[i];
+                n->children[i - 1] = n->children[i];
+            }
+            n->count--;
+            if (n->count > 3) return;
+            Node4* shrunk = create<Node4>();
+            copyHeader(shrunk, n);
+            memcpy(shrunk->keys, n->keys, n->count);
+            memcpy(shrunk->children, n->children, n->count * sizeof(Node*));
+            release(n);
+            ref = shrunk;
+            return;
+        }
+        case NODE48: {
+            Node48* n = static_cast<Node48*>(node);
+            *slot = nullptr;
+            n->childIndex[byte] = 0;
+            n->count--;
+            if (n->count > 12) return;
+            Node16* shrunk = create<Node16>();
+            copyHeader(shrunk, n);
+            shrunk->count = 0;
+            for (int b = 0; b < 256; b++) {
+                if (n->childIndex[b] == 0) continue;
+                shrunk->keys[shrunk->count] = static_cast<uint8_t>(b);
+                shrunk->children[shrunk->count++] = n->children[n->childIndex[b] - 1];
+            }
+            release(n);
+            ref = shrunk;
+            return;
+        }
+        case NODE256: {
+            Node256* n = static_cast<Node256*>(node);
+            *slot = nullptr;
+            n->count--;
+            if (n->count > 37) return;
+            Node48* shrunk = create<Node48>();
+            copyHeader(shrunk, n);
+            shrunk->count = 0;
+            for (int b = 0; b < 256; b++) {
+                if (n->children[b] == nullptr) continue;
+                shrunk->children[shrunk->count] = n->children[b];
+                shrunk->childIndex[b] = static_cast<uint8_t>(++shrunk->count);
+            }
+            release(n);
+            ref = shrunk;
+            return;
+        }
+        }
+    }
+
+    void insert(Node*& ref, string_view key, size_t depth, TermEntry*& entry) {
+        if (ref == nullptr) {
+            ref = newLeaf(key, entry);
+            return;
+        }
+        if (isLeaf(ref)) {
+            TermEntry* existing = asLeaf(ref);
+            if (existing->word == key) {
+                entry = existing;
+                return;
+            }
+            // two words meet in one slot, a Node4 after their common bytes tells them apart
+            size_t length = 0;
+            while (keyByte(existing->word, depth + length) == keyByte(key, depth + length)) length++;
+            Node* split = create<Node4>();
+            split->prefixLength = static_cast<uint32_t>(length);
+            memcpy(split->prefix, key.data() + depth, min(length, MAX_PREFIX));
+            addChild(split, keyByte(existing->word, depth + length), ref);
+            addChild(split, keyByte(key, depth + length), newLeaf(key, entry));
+            ref = split;
+            return;
+        }
+
+        Node* node = ref;
+        if (node->prefixLength != 0) {
+            size_t mismatch = prefixMismatch(node, key, depth);
+            if (mismatch < node->prefixLength) {
+                // the word leaves the compressed path part way, a Node4 splits the prefix there
+                Node* split = create<Node4>();
+                split->prefixLength = static_cast<uint32_t>(mismatch);
+                memcpy(split->prefix, node->prefix, min(mismatch, MAX_PREFIX));
+                uint8_t branch;
+                if (node->prefixLength <= MAX_PREFIX) {
+                    branch = node->prefix[mismatch];
+                    node->prefixLength -= mismatch + 1;
+                    memmove(node->prefix, node->prefix + mismatch + 1, node->prefixLength);
+                }
+                else {
+                    // only the first bytes are stored, the rest of the prefix comes from a leaf
+                    string_view word = minimumLeaf(node)->word;
+                    branch = keyByte(word, depth + mismatch);
+                    node->prefixLength -= mismatch + 1;
+                    memcpy(node->prefix, word.data() + depth + mismatch + 1, min<size_t>(node->prefixLength, MAX_PREFIX));
+                }
+                addChild(split, branch, node);
+                addChild(split, keyByte(key, depth + mismatch), newLeaf(key, entry));
+                ref = split;
+                return;
+            }
+            depth += node->prefixLength;
+        }
+
+        uint8_t byte = keyByte(key, depth);
+        Node** child = findChild(node, byte);
+        if (child != nullptr) insert(*child, key, depth + 1, entry);
+        else addChild(ref, byte, newLeaf(key, entry));
+    }
+
+    void remove(Node*& ref, string_view key, size_t depth) {
+        if (ref == nullptr) return;
+        if (isLeaf(ref)) {
+            if (asLeaf(ref)->word == key) {
+                destroy(ref);
+                ref = nullptr;
+            }
+            return;
+        }
+
+        Node* node = ref;
+        if (node->prefixLength != 0) {
+            if (prefixMismatch(node, key, depth) != node->prefixLength) return;
+            depth += node->prefixLength;
+        }
+        uint8_t byte = keyByte(key, depth);
+        Node** child = findChild(node, byte);
+        if (child == nullptr) return;
+        if (!isLeaf(*child)) {
+            remove(*child, key, depth + 1);
+            return;
+        }
+        if (asLeaf(*child)->word != key) return;
+        destroy(*child);
+        removeChild(ref, byte, child);
+    }
+
+    void destroy(Node* node) {
+        if (node == nullptr) return;
+        if (isLeaf(node)) {
+            delete asLeaf(node);
+            leafCount--;
+            return;
+        }
+        auto destroyChild = [this](Node* child) { destroy(child); };
+        forEachChild(node, destroyChild);
+        release(node);
+    }
+
+    template<class Visitor>
+    static void forEach(Node* node, Visitor& visit) {
+        if (node == nullptr) return;
+        if (isLeaf(node)) {
+            visit(static_cast<const TermEntry*>(asLeaf(node)));
+            return;
+        }
+        auto visitChild = [&visit](Node* child) { forEach(child, visit); };
+        forEachChild(node, visitChild);
+    }
+};
+
+// one complete set of dictionary engines; the serial build fills a single one and every
+// parallel ingest worker fills a private one
+struct SearchIndex {
+    TermStore terms;  // every word's letters and postings, the engines below refer to them
+    AVLSearchTree<string_view, WordItem*> myTree;
+    HashTable<HashNode*, string_view> hash_table;
+    FlatTable flat_table;
+    unique_ptr<PositionalIndex> positions;  // only built with --positions
+};
+
+// word must already be lower case and alphabetical. Every engine looks it up on every token, so
+// the engines keep doing the same work as each other; a new word is interned once and the
+// posting is updated once, in the store. Returns the word's term.
+uint32_t processWord(string_view word_lower, SearchIndex& index, uint32_t documentId, int count = 1) {
+    const FlatEntry* entry = index.flat_table.find(word_lower);
+    uint32_t term = entry ? entry->term : index.terms.add(word_lower);
+    string_view word = index.terms.word(term);
+    index.myTree.upsert(word)->term = term;
+    index.hash_table.insert(word, term);
+    if (!entry) index.flat_table.insert(word, term);
+    index.terms.addPosting(term, documentId, count);
+    return term;
+}
+
+// returns false when the file cannot be opened; the file itself is only mapped and never written
+// A file listed twice is counted twice but its positions are recorded only once (recordPositions
+// is false for the repeat), since the positional streams need increasing document ids.
+bool processFile(const string& filename, uint32_t documentId, SearchIndex& index, size_t& bytesRead, uint32_t& tokenCount, bool recordPositions = true) {
+    MappedFile file(filename);
+    if (!file.isOpen()) return false;
+
+    PositionalIndex* positions = recordPositions ? index.positions.get() : nullptr;
+    uint32_t position = 0;
+    // tokens are lowered into one reused buffer, so no allocation happens per token
+    string word_lower;
+    forEachToken(file.contents(), [&](string_view token) {
+        word_lower.assign(token.data(), token.size());
+        for (char& c : word_lower) c |= 0x20;
+        uint32_t term = processWord(word_lower, index, documentId);
+        if (positions) positions->add(index.terms.word(term), documentId, position);
+        position++;
+    });
+    if (positions) positions->finishDocument();
+    bytesRead += file.contents().size();
+    tokenCount = position;
+    return true;
+}
+
+// Walks the shards' trees side by side in word order, adding each word to terms once. Later
+// shards hold later files, so each word's postings are appended shard by shard; a file listed
+// twice has its counts summed just like in the serial build.
+vector<TermEntry> mergeVocabularies(const vector<unique_ptr<SearchIndex>>& shards, TermStore& terms) {
+    using Tree = AVLSearchTree<string_view, WordItem*>;
+    vector<Tree::Iterator> heads;
+    for (const auto& shard : shards) heads.push_back(shard->myTree.begin());
+    vector<TermEntry> vocabulary;
+    while (true) {
+        bool any = false;
+        string_view smallest;
+        for (size_t w = 0; w < heads.size(); w++) {
+            if (heads[w] == shards[w]->myTree.end() || (any && heads[w]->word >= smallest)) continue;
+            smallest = heads[w]->word;
+            any = true;
+        }
+        if (!any) break;
+
+        uint32_t term = terms.add(smallest);
+        string_view word = terms.word(term);
+        for (size_t w = 0; w < heads.size(); w++) {
+            if (heads[w] == shards[w]->myTree.end() || heads[w]->word != word) continue;
+            for (const auto& detail : shards[w]->terms.postings(heads[w]->term)) terms.addPosting(term, detail.documentId, detail.count);
+            ++heads[w];
+        }
+        vocabulary.push_back({ word, term });
+    }
+    return vocabulary;
+}
+
+// Indexes every file into index and returns the number of bytes read. With more than one
+// thread each worker builds a private shard from a contiguous run of files, and the shards are
+// merged in file order, so every posting list comes out exactly as the serial build makes it.
+size_t ingestFiles(const vector<string>& filenames, DocumentTable& documents, SearchIndex& index, int threadCount) {
+    // ids are handed out up front, so every shard posts under the same global ids
+    vector<uint32_t> documentIds;
+    vector<char> firstListing;
+    for (const auto& filename : filenames) {
+        size_t known = documents.size();
+        documentIds.push_back(documents.getId(filename));
+        firstListing.push_back(documents.size() > known);
+    }
+
+    size_t bytesRead = 0;
+    vector<uint32_t> tokenCounts(filenames.size(), 0);
+    int workerCount = min<int>(threadCount, filenames.size());
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < filenames.size(); i++) {
+            if (!processFile(filenames[i], documentIds[i], index, bytesRead, tokenCounts[i], firstListing[i]))
+                cout << filenames[i] << " could not be opened!\n";
+            documents.addLength(documentIds[i], tokenCounts[i]);
+        }
+        return bytesRead;
+    }
+
+    vector<unique_ptr<SearchIndex>> shards;
+    vector<size_t> shardBytes(workerCount, 0);
+    vector<char> opened(filenames.size(), 0);
+    vector<thread> workers;
+    for (int w = 0; w < workerCount; w++) {
+        shards.emplace_back(new SearchIndex());
+        if (index.positions) shards[w]->positions.reset(new PositionalIndex());
+    }
+    for (int w = 0; w < workerCount; w++) {
+        workers.emplace_back([&, w]() {
+            size_t first = filenames.size() * w / workerCount;
+            size_t last = filenames.size() * (w + 1) / workerCount;
+            for (size_t i = first; i < last; i++)
+                opened[i] = processFile(filenames[i], documentIds[i], *shards[w], shardBytes[w], tokenCounts[i], firstListing[i]);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    for (size_t i = 0; i < filenames.size(); i++) {
+        if (!opened[i]) cout << filenames[i] << " could not be opened!\n";
+        documents.addLength(documentIds[i], tokenCounts[i]);
+    }
+    // The merged vocabulary comes out sorted, so the (still empty) tree is bulk-loaded from it
+    // instead of taking one insert per word; the hash tables take the words as they go by.
+    vector<TermEntry> vocabulary = mergeVocabularies(shards, index.terms);
+    for (const auto& entry : vocabulary) {
+        index.hash_table.insert(entry.word, entry.term);
+        index.flat_table.insert(entry.word, entry.term);
+    }
+    index.myTree.bulkLoad(vocabulary.begin(), vocabulary.end());
+    for (int w = 0; w < workerCount; w++) {
+        if (index.positions) {
+            index.positions->merge(*shards[w]->positions,
+                [&index](string_view word) { return index.terms.word(index.flat_table.find(word)->term); });
+        }
+        bytesRead += shardBytes[w];
+    }
+    return bytesRead;
+}
+
+vector<string> splitWords(const string& text) {
+    vector<string> words;
+    string word;
+    for (char c : text) {
+        if (isalpha(c)) {
+            word += c;
+        }
+        else {
+            if (!word.empty()) {
+                words.push_back(word);
+                word.clear();
+            }
+            words.push_back("\n");
+        }
+    }
+    if (!word.empty()) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// prints one line per document; documents and the words within a line come out alphabetically
+void printResults(const map<string, map<string, int>>& results, bool allWordsFound, ostream& out = cout) {
+    if (!allWordsFound) {
+        out << "No document contains the given query\n";
+        return;
+    }
+    for (const auto& doc : results) {
+        // a document matched by a boolean query through NOT alone has no words to show
+        if (doc.second.empty()) {
+            out << "in Document " << doc.first << ".\n";
+            continue;
+        }
+        out << "in Document " << doc.first << ", ";
+        bool first = true;
+        for (const auto& word : doc.second) {
+            if (!first) out << ", ";
+            out << word.first << " found " << word.second << " times";
+            first = false;
+        }
+        out << ".\n";
+    }
+}
+
+// LRU cache of query answers keyed on the sorted distinct words of a query, so neither word
+// order nor repeats make a new entry. Every entry is charged an estimate of its size against
+// the byte budget and the least recently used ones are evicted to stay under it. termKeys
+// lists the keys of the entries that mention a word, so a change to that word drops only them.
+// Only the plain queries of serveIndex use it: a boolean answer depends on the whole expression,
+// not on its sorted words, and the socket and sharded servers answer on many threads while the
+// cache is not synchronized.
+template<class Answer>
+class QueryCache {
+public:
+    explicit QueryCache(size_t byteBudget) : byteBudget(byteBudget) {}
+
+    // the sorted distinct words of splitWords output, the form entries are keyed on
+    static vector<string> normalize(const vector<string>& queryWords) {
+        vector<string> terms;
+        for (const auto& word : queryWords)
+            if (word != "\n") terms.push_back(word);
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+        return terms;
+    }
+
+    static string keyOf(const vector<string>& terms) {
+        string key;
+        for (const auto& term : terms) key += (key.empty() ? "" : " ") + term;
+        return key;
+    }
+
+    // the answer cached under key or nullptr; a hit becomes the most recently used entry
+    const Answer* find(const string& key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        order.splice(order.begin(), order, it->second);
+        return &it->second->answer;
+    }
+
+    // answerBytes is what the answer holds beyond its own object; answers larger than the
+    // whole budget are not kept
+    void insert(const string& key, const vector<string>& terms, Answer answer, size_t answerBytes) {
+        size_t bytes = sizeof(Entry) + 2 * key.size() + answerBytes + 64;
+        for (const auto& term : terms) bytes += sizeof(string) + term.size();
+        if (bytes > byteBudget) return;
+        auto existing = entries.find(key);
+        if (existing != entries.end()) erase(existing->second);
+
+        order.push_front({ key, terms, move(answer), bytes });
+        entries.emplace(key, order.begin());
+        for (const auto& term : terms) termKeys[term].push_back(key);
+        usedBytes += bytes;
+        while (usedBytes > byteBudget) erase(prev(order.end()));
+    }
+
+    // drops the entries whose query mentions word, returns how many
+    size_t invalidate(const string& word) {
+        auto it = termKeys.find(word);
+        if (it == termKeys.end()) return 0;
+        vector<string> keys = move(it->second);
+        termKeys.erase(it);
+        size_t dropped = 0;
+        for (const auto& key : keys) {
+            auto entry = entries.find(key);
+            if (entry == entries.end()) continue;
+            erase(entry->second);
+            dropped++;
+        }
+        return dropped;
+    }
+
+    void clear() {
+        order.clear();
+        entries.clear();
+        termKeys.clear();
+        usedBytes = 0;
+    }
+
+    // the latest latencySamples answer times of each kind are kept for the percentiles
+    void recordLatency(bool hit, long long nanoseconds) {
+        vector<long long>& samples = hit ? hitLatencies : missLatencies;
+        size_t& next = hit ? nextHitSample : nextMissSample;
+        if (samples.size() < latencySamples) samples.push_back(nanoseconds);
+        else samples[next] = nanoseconds;
+        next = (next + 1) % latencySamples;
+    }
+
+    double hitRatio() const {
+        return hits + misses == 0 ? 0.0 : hits / static_cast<double>(hits + misses);
+    }
+
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+    size_t size() const { return entries.size(); }
+    size_t memoryUsage() const { return usedBytes; }
+
+    void printStats(ostream& out) const {
+        out << "Query cache: " << entries.size() << " entries in " << usedBytes << " of " << byteBudget << " bytes, "
+            << hits << " hits, " << misses << " misses, hit ratio " << hitRatio() << "\n";
+        printPercentiles(out, "hits", hitLatencies);
+        printPercentiles(out, "misses", missLatencies);
+    }
+
+private:
+    struct Entry {
+        string key;
+        vector<string> terms;
+        Answer answer;
+        size_t bytes;
+    };
+
+    static const size_t latencySamples = 1 << 16;
+
+    size_t byteBudget;
+    size_t usedBytes = 0;
+    list<Entry> order;
+    unordered_map<string, typename list<Entry>::iterator> entries;
+    unordered_map<string, vector<string>> termKeys;
+    size_t hits = 0, misses = 0;
+    vector<long long> hitLatencies, missLatencies;
+    size_t nextHitSample = 0, nextMissSample = 0;
+
+    void erase(typename list<Entry>::iterator entry) {
+        for (const auto& term : entry->terms) {
+            auto it = termKeys.find(term);
+            if (it == termKeys.end()) continue;
+            vector<string>& keys = it->second;
+            auto key = std::find(keys.begin(), keys.end(), entry->key);
+            if (key != keys.end()) {
+                *key = move(keys.back());
+                keys.pop_back();
+            }
+            if (keys.empty()) termKeys.erase(it);
+        }
+        usedBytes -= entry->bytes;
+        entries.erase(entry->key);
+        order.erase(entry);
+    }
+
+    static void printPercentiles(ostream& out, const string& label, vector<long long> samples) {
+        if (samples.empty()) return;
+        sort(samples.begin(), samples.end());
+        out << label << ": p50 " << samples[samples.size() / 2] << " ns, p99 "
+            << samples[samples.size() - 1 - samples.size() / 100] << " ns\n";
+    }
+};
+
+// a conjunctive answer as the query cache keeps it, computed from the distinct query words
+struct CachedResults {
+    bool allWordsFound = false;
+    map<string, map<string, int>> results;
+
+    // rough heap footprint of the maps, for the cache budget
+    size_t memoryUsage() const {
+        size_t bytes = 0;
+        for (const auto& doc : results) {
+            bytes += 64 + doc.first.size();
+            for (const auto& word : doc.second) bytes += 64 + word.first.size();
+        }
+        return bytes;
+    }
+};
+
+// conjunctiveResults counts a word once per time the query repeats it while cached answers come
+// from the distinct words, so a query with repeats is printed from a scaled copy
+void printCachedResults(const CachedResults& answer, const vector<string>& queryWords, const vector<string>& terms) {
+    size_t wordCount = count_if(queryWords.begin(), queryWords.end(), [](const string& word) { return word != "\n"; });
+    if (!answer.allWordsFound || wordCount == terms.size()) {
+        printResults(answer.results, answer.allWordsFound);
+        return;
+    }
+    map<string, int> repeats;
+    for (const auto& word : queryWords) repeats[word]++;
+    map<string, map<string, int>> scaled(answer.results);
+    for (auto& doc : scaled)
+        for (auto& word : doc.second) word.second *= repeats[word.first];
+    printResults(scaled, true);
+}
+
+// Boolean queries: words, "quoted phrases" (optionally followed by ~slop), AND, OR, NOT and
+// parentheses, with AND implied between neighbouring operands. The operators are only
+// recognised in capitals, so lower case "and", "or" and "not" stay ordinary words.
+struct QueryNode {
+    enum Kind { TERM, PHRASE, AND, OR, NOT };
+    Kind kind;
+    vector<string> words;   // the word of a TERM, the words of a PHRASE
+    int slop = 0;
+    vector<unique_ptr<QueryNode>> children;
+    // filled in by planQuery: the postings of the words and an estimate of the matching documents
+    vector<PostingSpan> postings;
+    size_t cost = 0;
+
+    explicit QueryNode(Kind kind) : kind(kind) {}
+};
+
+// true when search uses an operator, parentheses or a quoted phrase, so it is not a plain
+// conjunctive query
+bool isBooleanQuery(const string& search) {
+    if (search.find_first_of("()\"") != string::npos) return true;
+    for (const auto& word : splitWords(search))
+        if (word == "AND" || word == "OR" || word == "NOT") return true;
+    return false;
+}
+
+class QueryParser {
+public:
+    // the operator tree of search, or nullptr with error describing the first problem found
+    unique_ptr<QueryNode> parse(const string& search, string& error) {
+        tokens.clear();
+        next = 0;
+        if (!tokenize(search, error)) return nullptr;
+        if (tokens.size() == 1) {
+            error = "The query is empty";
+            return nullptr;
+        }
+        unique_ptr<QueryNode> root = parseOr(error);
+        if (root && tokens[next].kind != Token::END) {
+            error = tokens[next].kind == Token::CLOSE ? "Unmatched ) in the query" : "Unexpected operator in the query";
+            return nullptr;
+        }
+        return root;
+    }
+
+private:
+    struct Token {
+        enum Kind { WORD, PHRASE, AND, OR, NOT, OPEN, CLOSE, END };
+        Kind kind;
+        vector<string> words;
+        int slop;
+    };
+
+    vector<Token> tokens;
+    size_t next = 0;
+
+    bool tokenize(const string& search, string& error) {
+        size_t i = 0;
+        while (i < search.size()) {
+            unsigned char c = search[i];
+            if (isalpha(c)) {
+                size_t end = i;
+                while (end < search.size() && isalpha(static_cast<unsigned char>(search[end]))) end++;
+                string word = search.substr(i, end - i);
+                if (word == "AND") tokens.push_back({ Token::AND, {}, 0 });
+                else if (word == "OR") tokens.push_back({ Token::OR, {}, 0 });
+                else if (word == "NOT") tokens.push_back({ Token::NOT, {}, 0 });
+                else tokens.push_back({ Token::WORD, { tolower_string(word) }, 0 });
+                i = end;
+            }
+            else if (c == '"') {
+                size_t close = search.find('"', i + 1);
+                if (close == string::npos) {
+                    error = "Unterminated \" in the query";
+                    return false;
+                }
+                Token phrase = { Token::PHRASE, {}, 0 };
+                for (const auto& word : splitWords(tolower_string(search.substr(i + 1, close - i - 1))))
+                    if (word != "\n") phrase.words.push_back(word);
+                i = close + 1;
+                if (i + 1 < search.size() && search[i] == '~' && isdigit(static_cast<unsigned char>(search[i + 1]))) {
+                    size_t end = i + 1;
+                    while (end < search.size() && isdigit(static_cast<unsigned char>(search[end]))) end++;
+                    phrase.slop = stoi(search.substr(i + 1, end - i - 1));
+                    i = end;
+                }
+                if (phrase.words.empty()) {
+                    error = "Empty phrase in the query";
+                    return false;
+                }
+                if (phrase.words.size() == 1) phrase.kind = Token::WORD;
+                tokens.push_back(phrase);
+            }
+            else {
+                if (c == '(') tokens.push_back({ Token::OPEN, {}, 0 });
+                else if (c == ')') tokens.push_back({ Token::CLOSE, {}, 0 });
+                i++;
+            }
+        }
+        tokens.push_back({ Token::END, {}, 0 });
+        return true;
+    }
+
+    // or := and (OR and)*
+    unique_ptr<QueryNode> parseOr(string& error) {
+        unique_ptr<QueryNode> left = parseAnd(error);
+        if (!left || tokens[next].kind != Token::OR) return left;
+        unique_ptr<QueryNode> node(new QueryNode(QueryNode::OR));
+        node->children.push_back(move(left));
+        while (tokens[next].kind == Token::OR) {
+            next++;
+            unique_ptr<QueryNode> right = parseAnd(error);
+            if (!right) return nullptr;
+            node->children.push_back(move(right));
+        }
+        return node;
+    }
+
+    // and := unary (AND? unary)*
+    unique_ptr<QueryNode> parseAnd(string& error) {
+        unique_ptr<QueryNode> left = parseUnary(error);
+        if (!left) return nullptr;
+        unique_ptr<QueryNode> node;
+        while (true) {
+            Token::Kind kind = tokens[next].kind;
+            if (kind == Token::AND) next++;
+            else if (kind != Token::WORD && kind != Token::PHRASE && kind != Token::NOT && kind != Token::OPEN) break;
+            unique_ptr<QueryNode> right = parseUnary(error);
+            if (!right) return nullptr;
+            if (!node) {
+                node.reset(new QueryNode(QueryNode::AND));
+                node->children.push_back(move(left));
+            }
+            node->children.push_back(move(right));
+        }
+        return node ? move(node) : move(left);
+    }
+
+    // unary := NOT unary | word | phrase | ( or )
+    unique_ptr<QueryNode> parseUnary(string& error) {
+        Token& token = tokens[next];
+        switch (token.kind) {
+        case Token::NOT: {
+            next++;
+            unique_ptr<QueryNode> operand = parseUnary(error);
+            if (!operand) return nullptr;
+            unique_ptr<QueryNode> node(new QueryNode(QueryNode::NOT));
+            node->children.push_back(move(operand));
+            return node;
+        }
+        case Token::WORD:
+        case Token::PHRASE: {
+            next++;
+            unique_ptr<QueryNode> node(new QueryNode(token.kind == Token::WORD ? QueryNode::TERM : QueryNode::PHRASE));
+            node->words = token.words;
+            node->slop = token.slop;
+            return node;
+        }
+        case Token::OPEN: {
+            next++;
+            unique_ptr<QueryNode> inner = parseOr(error);
+            if (!inner) return nullptr;
+            if (tokens[next].kind != Token::CLOSE) {
+                error = "Missing ) in the query";
+                return nullptr;
+            }
+            next++;
+            return inner;
+        }
+        default:
+            error = token.kind == Token::END ? "The query ends with an operator" : "An operator is missing its word";
+            return nullptr;
+        }
+    }
+};
+
+// Rewrites a parsed tree for evaluation. NOT is pushed down to the words and phrases by De
+// Morgan's laws, nested ANDs and ORs are flattened, and every node gets the estimated number
+// of documents it matches: the postings length of a word, the shortest operand of an AND and
+// the sum of the operands of an OR. AND operands are then ordered so that evaluation starts
+// from the smallest set and applies the NOT operands last, as differences from it.
+// lookup(word, span) reports whether word is indexed and where its postings are.
+template<class Lookup>
+void planQuery(unique_ptr<QueryNode>& node, Lookup lookup, size_t documentCount, bool negated = false) {
+    if (node->kind == QueryNode::NOT) {
+        unique_ptr<QueryNode> operand = move(node->children[0]);
+        planQuery(operand, lookup, documentCount, !negated);
+        node = move(operand);
+        return;
+    }
+    if (node->kind == QueryNode::TERM || node->kind == QueryNode::PHRASE) {
+        node->cost = documentCount;
+        for (const auto& word : node->words) {
+            PostingSpan span = { nullptr, 0 };
+            if (!lookup(word, span)) span = { nullptr, 0 };
+            node->postings.push_back(span);
+            node->cost = min(node->cost, span.size);
+        }
+        if (negated) {
+            unique_ptr<QueryNode> complement(new QueryNode(QueryNode::NOT));
+            complement->cost = documentCount - node->cost;
+            complement->children.push_back(move(node));
+            node = move(complement);
+        }
+        return;
+    }
+
+    if (negated) node->kind = node->kind == QueryNode::AND ? QueryNode::OR : QueryNode::AND;
+    vector<unique_ptr<QueryNode>> operands;
+    for (auto& child : node->children) {
+        planQuery(child, lookup, documentCount, negated);
+        if (child->kind == node->kind) {
+            for (auto& grandchild : child->children) operands.push_back(move(grandchild));
+        }
+        else {
+            operands.push_back(move(child));
+        }
+    }
+    node->children = move(operands);
+
+    if (node->kind == QueryNode::OR) {
+        node->cost = 0;
+        for (const auto& child : node->children) node->cost = min(documentCount, node->cost + child->cost);
+        return;
+    }
+    // the smallest positive operand first, then the larger ones, then the differences starting
+    // from the one that excludes the most documents, which is the one with the lowest cost
+    stable_sort(node->children.begin(), node->children.end(), [](const unique_ptr<QueryNode>& a, const unique_ptr<QueryNode>& b) {
+        bool aExcludes = a->kind == QueryNode::NOT, bExcludes = b->kind == QueryNode::NOT;
+        if (aExcludes != bExcludes) return bExcludes;
+        return a->cost < b->cost;
+    });
+    node->cost = documentCount;
+    for (const auto& child : node->children) node->cost = min(node->cost, child->cost);
+}
+
+// Evaluates a planned tree to the sorted ids of the matching documents. An AND materialises
+// only its first operand and narrows that down through the others, galloping through their
+// postings from the surviving candidates, so large operands are probed rather than read whole.
+// Without a positional index a phrase matches the documents that hold all of its words.
+class QueryEvaluator {
+public:
+    QueryEvaluator(size_t documentCount, const PositionalIndex* positions)
+        : documentCount(documentCount), positions(positions) {}
+
+    vector<uint32_t> evaluate(const QueryNode& node) {
+        vector<uint32_t> documents;
+        switch (node.kind) {
+        case QueryNode::TERM:
+            documents.reserve(node.postings[0].size);
+            for (size_t i = 0; i < node.postings[0].size; i++) documents.push_back(node.postings[0].items[i].documentId);
+            postingsTouched += node.postings[0].size;
+            break;
+        case QueryNode::PHRASE:
+            if (positions) {
+                for (const auto& match : positions->phraseQuery(node.words, node.slop)) documents.push_back(match.documentId);
+            }
+            else {
+                documents = intersectPostings(node.postings);
+                for (const auto& span : node.postings) postingsTouched += span.size;
+            }
+            break;
+        case QueryNode::AND:
+            if (node.children[0]->kind == QueryNode::NOT) documents = allDocuments();
+            else documents = evaluate(*node.children[0]);
+            for (size_t i = node.children[0]->kind == QueryNode::NOT ? 0 : 1; i < node.children.size() && !documents.empty(); i++)
+                filter(*node.children[i], documents);
+            break;
+        case QueryNode::OR:
+            for (const auto& child : node.children) {
+                vector<uint32_t> more = evaluate(*child), merged;
+                set_union(documents.begin(), documents.end(), more.begin(), more.end(), back_inserter(merged));
+                documents.swap(merged);
+            }
+            break;
+        case QueryNode::NOT:
+            documents = allDocuments();
+            filter(node, documents);
+            break;
+        }
+        return documents;
+    }
+
+    // postings copied out whole plus single probes into postings, so far
+    size_t getPostingsTouched() const { return postingsTouched; }
+
+private:
+    size_t documentCount;
+    const PositionalIndex* positions;
+    size_t postingsTouched = 0;
+
+    vector<uint32_t> allDocuments() const {
+        vector<uint32_t> documents(documentCount);
+        for (size_t id = 0; id < documentCount; id++) documents[id] = static_cast<uint32_t>(id);
+        return documents;
+    }
+
+    // keeps the candidates that match node
+    void filter(const QueryNode& node, vector<uint32_t>& candidates) {
+        switch (node.kind) {
+        case QueryNode::TERM: {
+            PostingSpan list = node.postings[0];
+            size_t cursor = 0, kept = 0;
+            for (uint32_t candidate : candidates) {
+                cursor = gallopTo(list, cursor, candidate);
+                postingsTouched++;
+                if (cursor == list.size) break;
+                if (list.items[cursor].documentId == candidate) candidates[kept++] = candidate;
+            }
+            candidates.resize(kept);
+            break;
+        }
+        case QueryNode::AND:
+            for (const auto& child : node.children) {
+                if (candidates.empty()) break;
+                filter(*child, candidates);
+            }
+            break;
+        case QueryNode::OR: {
+            // each operand only sees the candidates no earlier operand matched
+            vector<uint32_t> matched, remaining(candidates);
+            for (const auto& child : node.children) {
+                if (remaining.empty()) break;
+                vector<uint32_t> hits(remaining), merged, rest;
+                filter(*child, hits);
+                set_union(matched.begin(), matched.end(), hits.begin(), hits.end(), back_inserter(merged));
+                set_difference(remaining.begin(), remaining.end(), hits.begin(), hits.end(), back_inserter(rest));
+                matched.swap(merged);
+                remaining.swap(rest);
+            }
+            candidates.swap(matched);
+            break;
+        }
+        case QueryNode::NOT: {
+            vector<uint32_t> excluded(candidates), kept;
+            filter(*node.children[0], excluded);
+            set_difference(candidates.begin(), candidates.end(), excluded.begin(), excluded.end(), back_inserter(kept));
+            candidates.swap(kept);
+            break;
+        }
+        case QueryNode::PHRASE: {
+            vector<uint32_t> phrase = evaluate(node), kept;
+            set_intersection(candidates.begin(), candidates.end(), phrase.begin(), phrase.end(), back_inserter(kept));
+            candidates.swap(kept);
+            break;
+        }
+        }
+    }
+};
+
+// Parses, plans and evaluates a boolean query. Fills results with a line per matching document
+// holding the counts of the words and phrases the query asks for, words only under NOT are not
+// shown; returns false with error set when search does not parse.
+template<class Lookup, class NameOf>
+bool booleanResults(const string& search, Lookup lookup, NameOf documentName, size_t documentCount,
+    const PositionalIndex* positions, map<string, map<string, int>>& results, string& error) {
+    QueryParser parser;
+    unique_ptr<QueryNode> root = parser.parse(search, error);
+    if (!root) return false;
+    planQuery(root, lookup, documentCount);
+    QueryEvaluator evaluator(documentCount, positions);
+    vector<uint32_t> matching = evaluator.evaluate(*root);
+
+    for (uint32_t documentId : matching) results[documentName(documentId)];
+    vector<const QueryNode*> pending = { root.get() };
+    while (!pending.empty()) {
+        const QueryNode* node = pending.back();
+        pending.pop_back();
+        if (node->kind == QueryNode::AND || node->kind == QueryNode::OR) {
+            for (const auto& child : node->children) pending.push_back(child.get());
+        }
+        else if (node->kind == QueryNode::PHRASE && positions) {
+            string quoted;
+            for (const auto& word : node->words) quoted += (quoted.empty() ? "\"" : " ") + word;
+            quoted += "\"";
+            for (const auto& match : positions->phraseQuery(node->words, node->slop))
+                if (binary_search(matching.begin(), matching.end(), match.documentId))
+                    results[documentName(match.documentId)][quoted] = match.count;
+        }
+        else if (node->kind == QueryNode::TERM || node->kind == QueryNode::PHRASE) {
+            // without positions a phrase is matched as its words, so their counts are shown
+            for (size_t i = 0; i < node->postings.size(); i++) {
+                size_t cursor = 0;
+                for (uint32_t documentId : matching) {
+                    cursor = gallopTo(node->postings[i], cursor, documentId);
+                    if (cursor == node->postings[i].size) break;
+                    if (node->postings[i].items[cursor].documentId == documentId)
+                        results[documentName(documentId)][node->words[i]] = node->postings[i].items[cursor].count;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// prints what booleanResults finds, or why search does not parse
+template<class Lookup, class NameOf>
+void answerBooleanQuery(const string& search, Lookup lookup, NameOf documentName, size_t documentCount,
+    const PositionalIndex* positions, ostream& out = cout) {
+    map<string, map<string, int>> results;
+    string error;
+    if (booleanResults(search, lookup, documentName, documentCount, positions, results, error)) printResults(results, !results.empty(), out);
+    else out << error << "\n";
+}
+
+// On-disk index, version 1. All sections are arrays of the fixed size records below at the
+// offsets named in the header, so a mapped file is used in place without any parsing:
+//   header | document entries | term entries sorted by word | string bytes | postings
+// Numbers are stored in the byte order of the machine that built the file.
+const char INDEX_FILE_MAGIC[8] = { 'S', 'E', 'I', 'D', 'X', 0, 0, 0 };
+const uint32_t INDEX_FILE_VERSION = 1;
+
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t documentCount;
+    uint64_t termCount;
+    uint64_t documentsOffset;
+    uint64_t termsOffset;
+    uint64_t stringsOffset;
+    uint64_t postingsOffset;
+    uint64_t fileSize;
+};
+
+struct IndexDocumentEntry {
+    uint64_t nameOffset;     // relative to stringsOffset
+    uint64_t nameLength;
+};
+
+struct IndexTermEntry {
+    uint64_t wordOffset;     // relative to stringsOffset
+    uint32_t wordLength;
+    uint32_t postingCount;
+    uint64_t firstPosting;   // index into the postings array
+};
+
+bool writeIndexFile(const string& path, const DocumentTable& documents, const SearchIndex& index) {
+    // the tree hands out the words already sorted
+    vector<const WordItem*> entries;
+    index.myTree.forEach([&](const WordItem* node) { entries.push_back(node); });
+
+    string strings;
+    vector<IndexDocumentEntry> documentEntries;
+    for (uint32_t id = 0; id < documents.size(); id++) {
+        documentEntries.push_back({ strings.size(), documents.name(id).size() });
+        strings += documents.name(id);
+    }
+    vector<IndexTermEntry> termEntries;
+    uint64_t postingCount = 0;
+    for (const WordItem* entry : entries) {
+        const vector<DocumentItem>& details = index.terms.postings(entry->term);
+        termEntries.push_back({ strings.size(), static_cast<uint32_t>(entry->word.size()),
+            static_cast<uint32_t>(details.size()), postingCount });
+        strings += entry->word;
+        postingCount += details.size();
+    }
+
+    IndexFileHeader header = {};
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = INDEX_FILE_VERSION;
+    header.documentCount = documentEntries.size();
+    header.termCount = termEntries.size();
+    header.documentsOffset = sizeof(IndexFileHeader);
+    header.termsOffset = header.documentsOffset + documentEntries.size() * sizeof(IndexDocumentEntry);
+    header.stringsOffset = header.termsOffset + termEntries.size() * sizeof(IndexTermEntry);
+    header.postingsOffset = (header.stringsOffset + strings.size() + 7) / 8 * 8;
+    header.fileSize = header.postingsOffset + postingCount * sizeof(DocumentItem);
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(documentEntries.data()), documentEntries.size() * sizeof(IndexDocumentEntry));
+    out.write(reinterpret_cast<const char*>(termEntries.data()), termEntries.size() * sizeof(IndexTermEntry));
+    out.write(strings.data(), strings.size());
+    out.write("\0\0\0\0\0\0\0", header.postingsOffset - header.stringsOffset - strings.size());
+    for (const WordItem* entry : entries) {
+        const vector<DocumentItem>& details = index.terms.postings(entry->term);
+        out.write(reinterpret_cast<const char*>(details.data()), details.size() * sizeof(DocumentItem));
+    }
+    return static_cast<bool>(out);
+}
+
+// Read-only view of an index file. Opening maps the file and checks once that every section and
+// every record in it stays inside the file, so lookups binary search the term entries inside the
+// mapping without any checks of their own and a truncated or corrupt file is never opened.
+class IndexFile {
+public:
+    explicit IndexFile(const string& path) : file(path), header(nullptr) {
+        string_view bytes = file.contents();
+        if (bytes.size() < sizeof(IndexFileHeader)) return;
+        const IndexFileHeader* candidate = reinterpret_cast<const IndexFileHeader*>(bytes.data());
+        if (memcmp(candidate->magic, INDEX_FILE_MAGIC, sizeof(candidate->magic)) != 0 ||
+            candidate->version != INDEX_FILE_VERSION || candidate->fileSize != bytes.size())
+            return;
+        uint64_t size = candidate->fileSize;
+        if (candidate->documentsOffset % 8 != 0 || candidate->termsOffset % 8 != 0 || candidate->postingsOffset % 8 != 0 ||
+            !fits(candidate->documentsOffset, candidate->documentCount, sizeof(IndexDocumentEntry), candidate->termsOffset) ||
+            !fits(candidate->termsOffset, candidate->termCount, sizeof(IndexTermEntry), candidate->stringsOffset) ||
+            candidate->stringsOffset > candidate->postingsOffset || candidate->postingsOffset > size ||
+            (size - candidate->postingsOffset) % sizeof(DocumentItem) != 0)
+            return;
+
+        const char* base = bytes.data();
+        uint64_t stringsSize = candidate->postingsOffset - candidate->stringsOffset;
+        uint64_t postingCount = (size - candidate->postingsOffset) / sizeof(DocumentItem);
+        const IndexDocumentEntry* documents = reinterpret_cast<const IndexDocumentEntry*>(base + candidate->documentsOffset);
+        for (uint32_t id = 0; id < candidate->documentCount; id++) {
+            if (!fits(documents[id].nameOffset, documents[id].nameLength, 1, stringsSize)) return;
+        }
+        const IndexTermEntry* terms = reinterpret_cast<const IndexTermEntry*>(base + candidate->termsOffset);
+        for (uint64_t t = 0; t < candidate->termCount; t++) {
+            if (!fits(terms[t].wordOffset, terms[t].wordLength, 1, stringsSize) ||
+                !fits(terms[t].firstPosting, terms[t].postingCount, 1, postingCount))
+                return;
+        }
+        // document ids name documents and index tables sized by the document count
+        const DocumentItem* postings = reinterpret_cast<const DocumentItem*>(base + candidate->postingsOffset);
+        for (uint64_t p = 0; p < postingCount; p++) {
+            if (postings[p].documentId >= candidate->documentCount) return;
+        }
+        header = candidate;
+    }
+
+    bool isOpen() const {
+        return header != nullptr;
+    }
+
+    uint64_t getTermCount() const {
+        return header->termCount;
+    }
+
+    uint32_t getDocumentCount() const {
+        return header->documentCount;
+    }
+
+    string_view documentName(uint32_t id) const {
+        const IndexDocumentEntry& entry = documentEntries()[id];
+        return string_view(strings() + entry.nameOffset, entry.nameLength);
+    }
+
+    // false when the word is not indexed, otherwise span is set to its postings
+    bool find(string_view word, PostingSpan& span) const {
+        const IndexTermEntry* terms = termEntries();
+        const IndexTermEntry* entry = lower_bound(terms, terms + header->termCount, word,
+            [this](const IndexTermEntry& term, string_view key) { return termWord(term) < key; });
+        if (entry == terms + header->termCount || termWord(*entry) != word) return false;
+        span = PostingSpan{ postings() + entry->firstPosting, entry->postingCount };
+        return true;
+    }
+
+private:
+    MappedFile file;
+    const IndexFileHeader* header;
+
+    // whether count records of size bytes starting at offset end by limit, without overflowing
+    static bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit) {
+        return offset <= limit && count <= (limit - offset) / size;
+    }
+
+    const char* base() const { return file.contents().data(); }
+    const char* strings() const { return base() + header->stringsOffset; }
+    const IndexDocumentEntry* documentEntries() const {
+        return reinterpret_cast<const IndexDocumentEntry*>(base() + header->documentsOffset);
+    }
+    const IndexTermEntry* termEntries() const {
+        return reinterpret_cast<const IndexTermEntry*>(base() + header->termsOffset);
+    }
+    const DocumentItem* postings() const {
+        return reinterpret_cast<const DocumentItem*>(base() + header->postingsOffset);
+    }
+    string_view termWord(const IndexTermEntry& term) const {
+        return string_view(strings() + term.wordOffset, term.wordLength);
+    }
+};
+
+// builds the index of filenames and writes it to path
+int buildIndex(const string& path, const vector<string>& filenames, int threadCount) {
+    DocumentTable documents;
+    SearchIndex index;
+    size_t bytes = ingestFiles(filenames, documents, index, threadCount);
+    if (!writeIndexFile(path, documents, index)) {
+        cout << path << " could not be written!\n";
+        return 1;
+    }
+    cout << "Indexed " << bytes << " bytes from " << documents.size() << " files, "
+        << index.flat_table.getUniqueWordCount() << " unique words written to " << path << "\n";
+    return 0;
+}
+
+// answers queries from a mapped index file until end of input or "endofinput"; repeated word
+// sets are answered from a cache of cacheBytes bytes and "cachestats" reports how it does
+int serveIndex(const string& path, size_t cacheBytes) {
+    auto start = chrono::high_resolution_clock::now();
+    IndexFile indexFile(path);
+    if (!indexFile.isOpen()) {
+        cout << path << " is not a valid index file!\n";
+        return 1;
+    }
+    auto openTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+    cout << "Loaded " << indexFile.getTermCount() << " words and " << indexFile.getDocumentCount()
+        << " documents in " << openTime.count() << " us\n";
+
+    auto lookup = [&indexFile](const string& word, PostingSpan& span) { return indexFile.find(word, span); };
+    auto documentName = [&indexFile](uint32_t id) { return string(indexFile.documentName(id)); };
+    QueryCache<CachedResults> cache(cacheBytes);
+    string search;
+    while (true) {
+        cout << "Enter queried words in one line: ";
+        if (!getline(cin, search)) break;
+        // boolean queries are not cached, their key would have to be the whole expression
+        bool isBoolean = isBooleanQuery(search);
+        string booleanSearch = search;
+        search = tolower_string(search);
+        if (search.substr(0, 10) == "endofinput") break;
+        if (search.substr(0, 10) == "cachestats") {
+            cache.printStats(cout);
+            continue;
+        }
+        if (isBoolean) {
+            answerBooleanQuery(booleanSearch, lookup, documentName, indexFile.getDocumentCount(), nullptr);
+            continue;
+        }
+
+        auto queryStart = chrono::high_resolution_clock::now();
+        vector<string> queryWords = splitWords(search);
+        vector<string> terms = QueryCache<CachedResults>::normalize(queryWords);
+        string key = QueryCache<CachedResults>::keyOf(terms);
+        const CachedResults* cached = cache.find(key);
+        CachedResults computed;
+        if (!cached) {
+            computed.allWordsFound = conjunctiveResults(terms, lookup, documentName, computed.results);
+        }
+        // the latency is the time to the answer, printing it is left out
+        cache.recordLatency(cached != nullptr, chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - queryStart).count());
+        printCachedResults(cached ? *cached : computed, queryWords, terms);
+        if (!cached) {
+            size_t answerBytes = computed.memoryUsage();
+            cache.insert(key, terms, move(computed), answerBytes);
+        }
+    }
+    return 0;
+}
+
+// Appends answers to a string in the text of the prompt, each ended by an empty line, or as
+// one JSON object per line: {"query":"...","documents":[{"document":"...","counts":{"word":n}}]}
+// with "error" in place of "documents" for a query that does not parse.
+class AnswerFormatter {
+public:
+    AnswerFormatter(string& out, bool json) : out(out), json(json) {}
+
+    void begin(string_view query) {
+        documentCount = 0;
+        if (json) {
+            out += "{\"query\":";
+            quote(query);
+            out += ",\"documents\":[";
+        }
+    }
+
+    void document(string_view name) {
+        closeDocument();
+        if (json) {
+            if (documentCount > 0) out += ',';
+            out += "{\"document\":";
+            quote(name);
+            out += ",\"counts\":{";
+        }
+        else {
+            out += "in Document ";
+            out.append(name.data(), name.size());
+        }
+        documentCount++;
+        wordCount = 0;
+        documentOpen = true;
+    }
+
+    void word(string_view word, int count) {
+        if (json) {
+            if (wordCount > 0) out += ',';
+            quote(word);
+            out += ':';
+            number(count);
+        }
+        else {
+            out += ", ";
+            out.append(word.data(), word.size());
+            out += " found ";
+            number(count);
+            out += " times";
+        }
+        wordCount++;
+    }
+
+    void end() {
+        closeDocument();
+        if (json) out += "]}\n";
+        else out += documentCount == 0 ? "No document contains the given query\n\n" : "\n";
+    }
+
+    void error(string_view query, const string& message) {
+        if (json) {
+            out += "{\"query\":";
+            quote(query);
+            out += ",\"error\":";
+            quote(message);
+            out += "}\n";
+        }
+        else {
+            out += message;
+            out += "\n\n";
+        }
+    }
+
+private:
+    string& out;
+    bool json;
+    size_t documentCount = 0, wordCount = 0;
+    bool documentOpen = false;
+
+    void closeDocument() {
+        if (!documentOpen) return;
+        out += json ? "}}" : ".\n";
+        documentOpen = false;
+    }
+
+    void number(int value) {
+        char digits[16];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr - digits);
+    }
+
+    void quote(string_view text) {
+        out += '"';
+        for (char c : text) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (u < 0x20) {
+                static const char hex[] = "0123456789abcdef";
+                out += "\\u00";
+                out += hex[u >> 4];
+                out += hex[u & 15];
+            }
+            else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+};
+
+// Answers one query line, plain or boolean, through formatter. Plain queries build no maps:
+// documents come out in name order through rank, the position of each document id in that order.
+template<class Lookup, class NameOf>
+void formatAnswer(string_view line, Lookup lookup, NameOf documentName, size_t documentCount,
+    const PositionalIndex* positions, const vector<uint32_t>& rank, AnswerFormatter& formatter) {
+    string query(line);
+    if (isBooleanQuery(query)) {
+        map<string, map<string, int>> results;
+        string error;
+        if (!booleanResults(query, lookup, documentName, documentCount, positions, results, error)) {
+            formatter.error(line, error);
+            return;
+        }
+        formatter.begin(line);
+        for (const auto& doc : results) {
+            formatter.document(doc.first);
+            for (const auto& word : doc.second) formatter.word(word.first, word.second);
+        }
+        formatter.end();
+        return;
+    }
+
+    // the distinct words in order, each with the number of times the query repeats it
+    vector<string> words;
+    for (auto& word : splitWords(tolower_string(query)))
+        if (word != "\n") words.push_back(move(word));
+    sort(words.begin(), words.end());
+    vector<pair<string, int>> terms;
+    for (auto& word : words) {
+        if (!terms.empty() && terms.back().first == word) terms.back().second++;
+        else terms.push_back({ move(word), 1 });
+    }
+
+    formatter.begin(line);
+    vector<PostingSpan> lists(terms.size());
+    bool allWordsFound = !terms.empty();
+    for (size_t t = 0; t < terms.size() && allWordsFound; t++) allWordsFound = lookup(terms[t].first, lists[t]);
+    vector<uint32_t> matching;
+    if (allWordsFound) matching = intersectPostings(lists);
+
+    // counts[m * terms + t] is the count of term t in the m-th matching document
+    vector<int> counts(matching.size() * terms.size());
+    for (size_t t = 0; t < terms.size(); t++) {
+        size_t cursor = 0;
+        for (size_t m = 0; m < matching.size(); m++) {
+            cursor = gallopTo(lists[t], cursor, matching[m]);
+            counts[m * terms.size() + t] = lists[t].items[cursor].count * terms[t].second;
+        }
+    }
+    vector<uint32_t> order(matching.size());
+    for (size_t m = 0; m < matching.size(); m++) order[m] = static_cast<uint32_t>(m);
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return rank[matching[a]] < rank[matching[b]]; });
+    for (uint32_t m : order) {
+        formatter.document(documentName(matching[m]));
+        for (size_t t = 0; t < terms.size(); t++) formatter.word(terms[t].first, counts[m * terms.size() + t]);
+    }
+    formatter.end();
+}
+
+// rank[id] is the position of document id when the documents are sorted by name
+template<class NameOf>
+vector<uint32_t> nameRanks(size_t documentCount, NameOf documentName) {
+    vector<uint32_t> byName(documentCount), rank(documentCount);
+    vector<string> names(documentCount);
+    for (uint32_t id = 0; id < documentCount; id++) {
+        byName[id] = id;
+        names[id] = string(documentName(id));
+    }
+    sort(byName.begin(), byName.end(), [&names](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+    for (uint32_t r = 0; r < documentCount; r++) rank[byName[r]] = r;
+    return rank;
+}
+
+// the text the prompt would print for one query line, plain or boolean, ended by an empty line
+template<class Lookup, class NameOf>
+string answerLine(const string& query, Lookup lookup, NameOf documentName, size_t documentCount,
+    const PositionalIndex* positions, const vector<uint32_t>& rank) {
+    string out;
+    AnswerFormatter formatter(out, false);
+    formatAnswer(query, lookup, documentName, documentCount, positions, rank, formatter);
+    return out;
+}
+
+// One part of a document-partitioned index: a subset of the documents with their own ids,
+// dictionary and postings. Queries read the frozen copy of the tree.
+struct IndexShard {
+    DocumentTable documents;
+    SearchIndex index;
+    FrozenDictionary frozen;
+};
+
+// The corpus split into shards by document, so a query can run on every shard at once and
+// each shard only walks the postings of its own documents. Shards hold consecutive ranges of
+// document names: every name in a shard sorts before the names in the next one, so results
+// printed shard by shard come out in the same order as from a single index.
+class ShardedIndex {
+public:
+    explicit ShardedIndex(size_t shardCount) {
+        for (size_t s = 0; s < max<size_t>(1, shardCount); s++) shards.emplace_back(new IndexShard());
+    }
+
+    // Cuts the files, sorted by name, into runs of about equal size in bytes and builds the
+    // shards side by side with threadCount threads shared among them.
+    size_t build(const vector<string>& filenames, int threadCount, bool withPositions) {
+        vector<pair<string, size_t>> files;
+        size_t totalSize = 0;
+        for (const auto& name : filenames) {
+            ifstream file(name, ios::binary | ios::ate);
+            files.push_back({ name, file ? static_cast<size_t>(file.tellg()) : 0 });
+            totalSize += files.back().second;
+        }
+        sort(files.begin(), files.end());
+        vector<vector<string>> runs(shards.size());
+        size_t before = 0, shard = 0;
+        for (size_t f = 0; f < files.size(); f++) {
+            // a new run starts once the current one has its share, the same name never straddles two
+            bool sameName = f > 0 && files[f].first == files[f - 1].first;
+            while (!sameName && shard + 1 < shards.size() && !runs[shard].empty() && before >= (shard + 1) * totalSize / shards.size()) shard++;
+            runs[shard].push_back(files[f].first);
+            before += files[f].second;
+        }
+
+        vector<size_t> bytes(shards.size(), 0);
+        vector<thread> builders;
+        int perShard = max<int>(1, threadCount / static_cast<int>(shards.size()));
+        for (size_t s = 0; s < shards.size(); s++) {
+            if (withPositions) shards[s]->index.positions.reset(new PositionalIndex());
+            builders.emplace_back([this, s, &runs, &bytes, perShard] {
+                bytes[s] = ingestFiles(runs[s], shards[s]->documents, shards[s]->index, perShard);
+            });
+        }
+        for (auto& builder : builders) builder.join();
+        freeze();
+        size_t total = 0;
+        for (size_t b : bytes) total += b;
+        return total;
+    }
+
+    // after documents were added to the shards directly, keeping the name ranges
+    void freeze() {
+        for (auto& shard : shards) shard->frozen.freeze(shard->index.myTree, shard->index.terms);
+    }
+
+    size_t size() const { return shards.size(); }
+    IndexShard& shard(size_t s) { return *shards[s]; }
+    const IndexShard& shard(size_t s) const { return *shards[s]; }
+
+    size_t documentCount() const {
+        size_t count = 0;
+        for (const auto& shard : shards) count += shard->documents.size();
+        return count;
+    }
+
+private:
+    vector<unique_ptr<IndexShard>> shards;
+};
+
+// A fixed set of threads for fanning work out. fanOut(count, task) runs task(i) for every i
+// below count and returns once all of them are done; the caller runs task(0) itself, so
+// count - 1 threads are enough for a count-way fan-out. Several threads may fan out at once.
+class TaskPool {
+public:
+    explicit TaskPool(int threadCount) {
+        for (int t = 0; t < threadCount; t++) threads.emplace_back([this] { work(); });
+    }
+
+    ~TaskPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    template<class Task>
+    void fanOut(size_t count, Task& task) {
+        if (count == 0) return;
+        if (threads.empty()) {
+            for (size_t i = 0; i < count; i++) task(i);
+            return;
+        }
+        Batch batch;
+        batch.run = [](void* context, size_t i) { (*static_cast<Task*>(context))(i); };
+        batch.task = &task;
+        batch.remaining = count - 1;
+        {
+            lock_guard<mutex> guard(lock);
+            for (size_t i = 1; i < count; i++) queue.push_back({ &batch, i });
+        }
+        if (count == 2) ready.notify_one();
+        else ready.notify_all();
+        task(0);
+        unique_lock<mutex> guard(batch.lock);
+        batch.done.wait(guard, [&batch] { return batch.remaining == 0; });
+    }
+
+    size_t threadCount() const { return threads.size(); }
+
+private:
+    struct Batch {
+        void (*run)(void*, size_t);
+        void* task;
+        size_t remaining;
+        mutex lock;
+        condition_variable done;
+    };
+    struct Item {
+        Batch* batch;
+        size_t index;
+    };
+
+    vector<thread> threads;
+    mutex lock;
+    condition_variable ready;
+    deque<Item> queue;
+    bool stopping = false;
+
+    void work() {
+#ifdef __linux__
+        // signals are left to the other threads, a server waits for them on a signalfd
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+        while (true) {
+            Item item;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                item = queue.front();
+                queue.pop_front();
+            }
+            item.batch->run(item.batch->task, item.index);
+            // notified under the lock: once fanOut sees zero and returns, the batch is gone
+            lock_guard<mutex> guard(item.batch->lock);
+            if (--item.batch->remaining == 0) item.batch->done.notify_one();
+        }
+    }
+};
+
+// Answers query on every shard at once, each shard printing the lines of its own documents,
+// and joins them into the text the prompt would print, ended by an empty line.
+string answerSharded(const string& query, const ShardedIndex& sharded, TaskPool& pool) {
+    bool isBoolean = isBooleanQuery(query);
+    vector<string> queryWords = splitWords(tolower_string(query));
+    vector<string> lines(sharded.size());
+    vector<char> found(sharded.size(), 0);
+    string error;
+    auto task = [&](size_t s) {
+        const IndexShard& shard = sharded.shard(s);
+        auto lookup = [&shard](const string& word, PostingSpan& span) { return shard.frozen.find(word, span); };
+        auto documentName = [&shard](uint32_t id) { return shard.documents.name(id); };
+        map<string, map<string, int>> results;
+        if (isBoolean) {
+            string shardError;
+            if (!booleanResults(query, lookup, documentName, shard.documents.size(), shard.index.positions.get(), results, shardError)) {
+                if (s == 0) error = shardError;
+                return;
+            }
+        }
+        else if (!conjunctiveResults(queryWords, lookup, documentName, results)) {
+            return;
+        }
+        found[s] = !results.empty();
+        ostringstream out;
+        printResults(results, true, out);
+        lines[s] = out.str();
+    };
+    pool.fanOut(sharded.size(), task);
+
+    if (!error.empty()) return error + "\n\n";
+    string answer;
+    for (size_t s = 0; s < sharded.size(); s++) answer += lines[s];
+    if (find(found.begin(), found.end(), 1) == found.end()) answer = "No document contains the given query\n";
+    return answer + "\n";
+}
+
+#ifdef __linux__
+// Line protocol over a Unix domain socket: every line a client sends is a query, answered with
+// what the prompt would print for it followed by an empty line, and "endofinput" ends the
+// connection. Clients may send any number of queries before reading; answers come back in the
+// order the queries were sent. One thread runs the epoll loop and does all of the socket I/O,
+// queries run on a pool of workers that hand their answers back through an eventfd.
+// answer(query) must be safe to call from several threads at once.
+template<class Answer>
+class QueryServer {
+public:
+    QueryServer(Answer answer, int workerCount) : answer(answer), workerCount(workerCount) {}
+
+    // serves path until SIGINT or SIGTERM, false when the socket cannot be set up; ready() is
+    // called once the socket is listening
+    template<class Ready>
+    bool run(const string& path, Ready ready) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+            if (listenFd >= 0) close(listenFd);
+            return false;
+        }
+        ready();
+
+        // blocked before the workers start so that they inherit the mask and only signalFd sees them
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        watch(listenFd, LISTEN_ID, EPOLLIN, EPOLL_CTL_ADD);
+        watch(eventFd, EVENT_ID, EPOLLIN, EPOLL_CTL_ADD);
+        watch(signalFd, SIGNAL_ID, EPOLLIN, EPOLL_CTL_ADD);
+
+        vector<thread> workers;
+        for (int w = 0; w < workerCount; w++) workers.emplace_back([this] { work(); });
+
+        bool running = true;
+        epoll_event events[64];
+        while (running) {
+            int ready = epoll_wait(epollFd, events, 64, -1);
+            if (ready < 0 && errno != EINTR) break;
+            for (int e = 0; e < ready; e++) {
+                uint64_t id = events[e].data.u64;
+                if (id == LISTEN_ID) acceptAll();
+                else if (id == EVENT_ID) collectAnswers();
+                else if (id == SIGNAL_ID) {
+                    // read so the signal is no longer pending when it is unblocked again
+                    signalfd_siginfo signal;
+                    ssize_t ignored = read(signalFd, &signal, sizeof(signal));
+                    (void)ignored;
+                    running = false;
+                }
+                else {
+                    auto it = connections.find(id);
+                    if (it == connections.end()) continue;
+                    if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readFrom(id, it->second);
+                    it = connections.find(id);
+                    if (it != connections.end() && (events[e].events & EPOLLOUT)) writeTo(id, it->second);
+                }
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(jobsLock);
+            stopping = true;
+        }
+        jobsReady.notify_all();
+        for (auto& worker : workers) worker.join();
+        for (auto& connection : connections) close(connection.second.fd);
+        connections.clear();
+        close(listenFd);
+        close(eventFd);
+        close(signalFd);
+        close(epollFd);
+        unlink(path.c_str());
+        pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+        return true;
+    }
+
+    size_t getQueryCount() const { return queryCount; }
+    size_t getConnectionCount() const { return nextConnection - FIRST_CONNECTION_ID; }
+
+private:
+    struct Job {
+        uint64_t connection;
+        uint64_t sequence;
+        string text;   // the query, then its answer
+    };
+
+    struct Connection {
+        int fd;
+        string input;
+        string output;
+        size_t written = 0;          // bytes of output already sent
+        uint64_t nextSequence = 0;   // given to the next query read
+        uint64_t nextToSend = 0;     // the answer output waits for
+        map<uint64_t, string> early; // answers that came back before an earlier one
+        bool inputClosed = false;
+        uint32_t interest = EPOLLIN;
+
+        size_t outstanding() const { return nextSequence - nextToSend; }
+    };
+
+    // ids in the epoll data; connections are numbered from FIRST_CONNECTION_ID and never reused
+    static const uint64_t LISTEN_ID = 0, EVENT_ID = 1, SIGNAL_ID = 2, FIRST_CONNECTION_ID = 3;
+    // a connection stops being read while this many of its answers are pending
+    static const size_t MAX_PIPELINE = 1024;
+
+    Answer answer;
+    int workerCount;
+    int listenFd = -1, eventFd = -1, signalFd = -1, epollFd = -1;
+    unordered_map<uint64_t, Connection> connections;
+    uint64_t nextConnection = FIRST_CONNECTION_ID;
+    size_t queryCount = 0;
+
+    mutex jobsLock;
+    condition_variable jobsReady;
+    deque<Job> jobs;
+    bool stopping = false;
+    mutex answersLock;
+    vector<Job> answers;
+
+    void watch(int fd, uint64_t id, uint32_t events, int operation) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = id;
+        epoll_ctl(epollFd, operation, fd, &event);
+    }
+
+    void work() {
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> guard(jobsLock);
+                jobsReady.wait(guard, [this] { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            job.text = answer(job.text);
+            bool wasEmpty;
+            {
+                lock_guard<mutex> guard(answersLock);
+                wasEmpty = answers.empty();
+                answers.push_back(move(job));
+            }
+            // the loop takes every answer at once, so only the first one of a batch has to wake it
+            if (wasEmpty) {
+                uint64_t one = 1;
+                ssize_t ignored = write(eventFd, &one, sizeof(one));
+                (void)ignored;
+            }
+        }
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            uint64_t id = nextConnection++;
+            Connection& connection = connections[id];
+            connection.fd = fd;
+            watch(fd, id, connection.interest, EPOLL_CTL_ADD);
+        }
+    }
+
+    void readFrom(uint64_t id, Connection& connection) {
+        char buffer[1 << 16];
+        while (!connection.inputClosed) {
+            ssize_t n = read(connection.fd, buffer, sizeof(buffer));
+            if (n > 0) connection.input.append(buffer, n);
+            else if (n == 0) {
+                // a last query without its newline is still answered
+                connection.inputClosed = true;
+                if (!connection.input.empty() && connection.input.back() != '\n') connection.input += '\n';
+            }
+            else if (errno == EINTR) continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            else {
+                drop(id, connection);
+                return;
+            }
+        }
+        submit(id, connection);
+        update(id, connection);
+    }
+
+    // queues the complete lines of input, as many as the pipeline limit allows
+    void submit(uint64_t id, Connection& connection) {
+        size_t start = 0, end;
+        vector<Job> batch;
+        while (connection.outstanding() + batch.size() < MAX_PIPELINE && (end = connection.input.find('\n', start)) != string::npos) {
+            string line = connection.input.substr(start, end - start);
+            start = end + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (tolower_string(line.substr(0, 10)) == "endofinput") {
+                connection.inputClosed = true;
+                start = connection.input.size();
+                break;
+            }
+            batch.push_back({ id, connection.nextSequence + batch.size(), move(line) });
+        }
+        connection.input.erase(0, start);
+        if (batch.empty()) return;
+        connection.nextSequence += batch.size();
+        queryCount += batch.size();
+        {
+            lock_guard<mutex> guard(jobsLock);
+            for (auto& job : batch) jobs.push_back(move(job));
+        }
+        if (batch.size() == 1) jobsReady.notify_one();
+        else jobsReady.notify_all();
+    }
+
+    void collectAnswers() {
+        uint64_t count;
+        ssize_t ignored = read(eventFd, &count, sizeof(count));
+        (void)ignored;
+        vector<Job> batch;
+        {
+            lock_guard<mutex> guard(answersLock);
+            batch.swap(answers);
+        }
+        vector<uint64_t> touched;
+        for (auto& job : batch) {
+            auto it = connections.find(job.connection);
+            if (it == connections.end()) continue;   // the client went away
+            it->second.early.emplace(job.sequence, move(job.text));
+            touched.push_back(job.connection);
+        }
+        sort(touched.begin(), touched.end());
+        touched.erase(unique(touched.begin(), touched.end()), touched.end());
+        for (uint64_t id : touched) {
+            Connection& connection = connections[id];
+            while (!connection.early.empty() && connection.early.begin()->first == connection.nextToSend) {
+                connection.output += connection.early.begin()->second;
+                connection.early.erase(connection.early.begin());
+                connection.nextToSend++;
+            }
+            writeTo(id, connection);
+        }
+    }
+
+    void writeTo(uint64_t id, Connection& connection) {
+        while (connection.written < connection.output.size()) {
+            ssize_t n = send(connection.fd, connection.output.data() + connection.written,
+                connection.output.size() - connection.written, MSG_NOSIGNAL);
+            if (n > 0) connection.written += n;
+            else if (n < 0 && errno == EINTR) continue;
+            else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            else {
+                drop(id, connection);
+                return;
+            }
+        }
+        if (connection.written == connection.output.size()) {
+            connection.output.clear();
+            connection.written = 0;
+        }
+        // answers went out, so lines held back by the pipeline limit may go in
+        submit(id, connection);
+        update(id, connection);
+    }
+
+    // closes a finished connection, or asks epoll for what it still needs
+    void update(uint64_t id, Connection& connection) {
+        if (connection.inputClosed && connection.outstanding() == 0 && connection.output.empty()) {
+            drop(id, connection);
+            return;
+        }
+        uint32_t interest = 0;
+        if (!connection.inputClosed && connection.outstanding() < MAX_PIPELINE) interest |= EPOLLIN;
+        if (!connection.output.empty()) interest |= EPOLLOUT;
+        if (interest != connection.interest) {
+            connection.interest = interest;
+            watch(connection.fd, id, interest, EPOLL_CTL_MOD);
+        }
+    }
+
+    void drop(uint64_t id, Connection& connection) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        connections.erase(id);
+    }
+};
+#endif
+
+// builds the index of filenames, or maps the index file at indexPath, once and answers queries
+// on the Unix socket at path with workerCount threads until interrupted
+int serveSocket(const string& path, const string& indexPath, const vector<string>& filenames,
+    int threadCount, int workerCount, bool withPositions, size_t shardCount) {
+#ifdef __linux__
+    auto serve = [&](auto answer, size_t wordCount, size_t documentCount) {
+        QueryServer<decltype(answer)> server(answer, workerCount);
+        // flushed, since run blocks until shutdown and whoever starts the server waits for this line
+        auto ready = [&] {
+            cout << "Serving " << wordCount << " words from " << documentCount << " documents on " << path
+                << " with " << workerCount << " workers\n" << flush;
+        };
+        if (!server.run(path, ready)) {
+            cout << path << " could not be listened on!\n";
+            return 1;
+        }
+        cout << "Answered " << server.getQueryCount() << " queries on " << server.getConnectionCount() << " connections\n";
+        return 0;
+    };
+
+    if (!indexPath.empty()) {
+        IndexFile indexFile(indexPath);
+        if (!indexFile.isOpen()) {
+            cout << indexPath << " is not a valid index file!\n";
+            return 1;
+        }
+        auto lookup = [&indexFile](const string& word, PostingSpan& span) { return indexFile.find(word, span); };
+        auto documentName = [&indexFile](uint32_t id) { return string(indexFile.documentName(id)); };
+        size_t documentCount = indexFile.getDocumentCount();
+        vector<uint32_t> rank = nameRanks(documentCount, documentName);
+        return serve([=, &rank](const string& query) { return answerLine(query, lookup, documentName, documentCount, nullptr, rank); },
+            indexFile.getTermCount(), documentCount);
+    }
+
+    if (shardCount > 1) {
+        // every query fans out over the shards, the pool is shared by all the workers
+        ShardedIndex sharded(shardCount);
+        sharded.build(filenames, threadCount, withPositions);
+        TaskPool pool(static_cast<int>(shardCount) - 1);
+        size_t wordCount = 0;
+        for (size_t s = 0; s < sharded.size(); s++) wordCount += sharded.shard(s).frozen.size();
+        cout << "Split into " << shardCount << " shards, words are counted once per shard\n";
+        return serve([&sharded, &pool](const string& query) { return answerSharded(query, sharded, pool); },
+            wordCount, sharded.documentCount());
+    }
+
+    DocumentTable documents;
+    SearchIndex index;
+    if (withPositions) index.positions.reset(new PositionalIndex());
+    ingestFiles(filenames, documents, index, threadCount);
+    // workers only read, from the frozen copy of the tree
+    FrozenDictionary frozen;
+    frozen.freeze(index.myTree, index.terms);
+    auto lookup = [&frozen](const string& word, PostingSpan& span) { return frozen.find(word, span); };
+    auto documentName = [&documents](uint32_t id) { return documents.name(id); };
+    const PositionalIndex* positions = index.positions.get();
+    size_t documentCount = documents.size();
+    vector<uint32_t> rank = nameRanks(documentCount, documentName);
+    return serve([=, &rank](const string& query) { return answerLine(query, lookup, documentName, documentCount, positions, rank); },
+        frozen.size(), documentCount);
+#else
+    cout << "--serve-socket needs Linux (epoll)\n";
+    return 1;
+#endif
+}
+
+// Collects output in one large buffer and hands it to the file in big writes.
+class BufferedWriter {
+public:
+    explicit BufferedWriter(FILE* file, size_t capacity = 1 << 22) : file(file), capacity(capacity) {
+        buffer.reserve(capacity);
+    }
+
+    ~BufferedWriter() {
+        flush();
+    }
+
+    void write(string_view text) {
+        if (buffer.size() + text.size() > capacity) flush();
+        if (text.size() >= capacity) {
+            written += fwrite(text.data(), 1, text.size(), file);
+            return;
+        }
+        buffer.append(text.data(), text.size());
+    }
+
+    void flush() {
+        if (!buffer.empty()) written += fwrite(buffer.data(), 1, buffer.size(), file);
+        buffer.clear();
+        fflush(file);
+    }
+
+    size_t bytesWritten() const { return written + buffer.size(); }
+
+private:
+    FILE* file;
+    size_t capacity;
+    string buffer;
+    size_t written = 0;
+};
+
+// Answers every line of queryPath up to "endofinput" and writes the answers in query order to
+// outputPath, or to standard output when it is empty. Queries are taken a chunk at a time and
+// every worker formats a contiguous part of the chunk into its own buffer, so the output keeps
+// the order of the file. Queries/s and bytes/s go to standard error, apart from the answers.
+template<class Lookup, class NameOf>
+int runBatch(const string& queryPath, const string& outputPath, bool json, int workerCount,
+    Lookup lookup, NameOf documentName, size_t documentCount, const PositionalIndex* positions) {
+    MappedFile queries(queryPath);
+    if (!queries.isOpen()) {
+        cerr << queryPath << " could not be opened!\n";
+        return 1;
+    }
+    FILE* file = outputPath.empty() ? stdout : fopen(outputPath.c_str(), "wb");
+    if (file == nullptr) {
+        cerr << outputPath << " could not be written!\n";
+        return 1;
+    }
+
+    vector<uint32_t> rank = nameRanks(documentCount, documentName);
+
+    auto start = chrono::high_resolution_clock::now();
+    size_t queryCount = 0, bytes = 0;
+    {
+        BufferedWriter writer(file);
+        TaskPool pool(workerCount - 1);
+        vector<string> buffers(workerCount);
+        vector<string_view> chunk;
+        const size_t chunkSize = 8192;
+        string_view text = queries.contents();
+        size_t position = 0;
+        while (position < text.size()) {
+            chunk.clear();
+            while (chunk.size() < chunkSize && position < text.size()) {
+                size_t end = text.find('\n', position);
+                if (end == string_view::npos) end = text.size();
+                string_view line = text.substr(position, end - position);
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                position = end + 1;
+                if (tolower_string(string(line.substr(0, 10))) == "endofinput") {
+                    position = text.size();
+                    break;
+                }
+                chunk.push_back(line);
+            }
+            auto task = [&](size_t w) {
+                buffers[w].clear();
+                AnswerFormatter formatter(buffers[w], json);
+                for (size_t q = w * chunk.size() / workerCount; q < (w + 1) * chunk.size() / workerCount; q++)
+                    formatAnswer(chunk[q], lookup, documentName, documentCount, positions, rank, formatter);
+            };
+            pool.fanOut(workerCount, task);
+            for (const auto& buffer : buffers) writer.write(buffer);
+            queryCount += chunk.size();
+        }
+        writer.flush();
+        bytes = writer.bytesWritten();
+    }
+    if (file != stdout) fclose(file);
+    double seconds = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count() / 1e6;
+    cerr << "Answered " << queryCount << " queries in " << seconds * 1000 << " ms with " << workerCount << " workers: "
+        << (seconds > 0 ? queryCount / seconds : 0.0) << " queries/s, " << bytes << " bytes written ("
+        << (seconds > 0 ? bytes / seconds / 1e6 : 0.0) << " MB/s)\n";
+    return 0;
+}
+
+// builds the index of filenames, or maps the index file at indexPath, and answers the queries
+// in queryPath as runBatch does
+int batchQueries(const string& queryPath, const string& outputPath, bool json, const string& indexPath,
+    const vector<string>& filenames, int threadCount, int workerCount, bool withPositions) {
+    if (!indexPath.empty()) {
+        IndexFile indexFile(indexPath);
+        if (!indexFile.isOpen()) {
+            cerr << indexPath << " is not a valid index file!\n";
+            return 1;
+        }
+        auto lookup = [&indexFile](const string& word, PostingSpan& span) { return indexFile.find(word, span); };
+        auto documentName = [&indexFile](uint32_t id) { return string(indexFile.documentName(id)); };
+        return runBatch(queryPath, outputPath, json, workerCount, lookup, documentName, indexFile.getDocumentCount(), nullptr);
+    }
+
+    DocumentTable documents;
+    SearchIndex index;
+    if (withPositions) index.positions.reset(new PositionalIndex());
+    ingestFiles(filenames, documents, index, threadCount);
+    FrozenDictionary frozen;
+    frozen.freeze(index.myTree, index.terms);
+    auto lookup = [&frozen](const string& word, PostingSpan& span) { return frozen.find(word, span); };
+    auto documentName = [&documents](uint32_t id) { return documents.name(id); };
+    return runBatch(queryPath, outputPath, json, workerCount, lookup, documentName, documents.size(), index.positions.get());
+}
+
+// synthetic alphabetical words so benchmarks do not depend on the input files
+string syntheticWord(int n) {
+    string word;
+    do {
+        word += char('a' + n % 26);
+        n /= 26;
+    } while (n > 0);
+    return word;
+}
+
+void benchRehashMode(HashTable<HashNode*, string_view>::RehashMode mode, const string& label, int wordCount) {
+    vector<string> words(wordCount);
+    for (int i = 0; i < wordCount; i++) words[i] = syntheticWord(i);
+    HashTable<HashNode*, string_view> table(mode);
+
+    vector<long long> latencies(wordCount);
+    auto total = chrono::high_resolution_clock::now();
+    for (int i = 0; i < wordCount; i++) {
+        auto start = chrono::high_resolution_clock::now();
+        table.insert(words[i], static_cast<uint32_t>(i));
+        latencies[i] = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count();
+    }
+    auto totalTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - total);
+
+    sort(latencies.begin(), latencies.end());
+    cout << label << ": total " << totalTime.count() << " ms"
+        << ", p50 " << latencies[wordCount / 2] << " ns"
+        << ", p99.9 " << latencies[wordCount - 1 - wordCount / 1000] << " ns"
+        << ", worst " << latencies.back() << " ns\n";
+}
+
+// reports the worst-case single insert latency of both rehash modes, against the original
+// replaying rehash as the before
+int benchRehash(int wordCount) {
+    cout << "Inserting " << wordCount << " distinct words\n";
+    benchRehashMode(HashTable<HashNode*, string_view>::REPLAY, "replaying rehash (before)", wordCount);
+    benchRehashMode(HashTable<HashNode*, string_view>::STOP_THE_WORLD, "stop-the-world rehash", wordCount);
+    benchRehashMode(HashTable<HashNode*, string_view>::INCREMENTAL, "incremental rehash", wordCount);
+    return 0;
+}
+
+template<class Lookup>
+void benchLookupEngine(const string& label, const vector<string>& queries, Lookup lookup) {
+    volatile size_t sink = 0;
+    auto start = chrono::high_resolution_clock::now();
+    for (const auto& query : queries) {
+        sink = sink + lookup(query);
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+    cout << label << ": " << elapsed.count() / queries.size() << " ns per lookup\n";
+}
+
+// random lookups on a dictionary much larger than the caches, where each engine pays for its misses
+int benchLookup(int wordCount) {
+    SearchIndex index;
+    vector<string> words(wordCount);
+    for (int i = 0; i < wordCount; i++) {
+        words[i] = syntheticWord(i);
+        processWord(words[i], index, 0);
+    }
+
+    vector<string> queries(words);
+    shuffle(queries.begin(), queries.end(), mt19937(42));
+    cout << "Looking up " << wordCount << " words in random order\n";
+    benchLookupEngine("AVL tree", queries, [&](const string& q) { return index.myTree.find(q) != nullptr; });
+    benchLookupEngine("hash table", queries, [&](const string& q) { return index.hash_table.find(q) != nullptr; });
+    benchLookupEngine("flat table", queries, [&](const string& q) { return index.flat_table.find(q) != nullptr; });
+    FrozenDictionary frozen;
+    frozen.freeze(index.myTree, index.terms);
+    benchLookupEngine("frozen dictionary", queries, [&](const string& q) { PostingSpan span; return frozen.find(q, span); });
+    return 0;
+}
+
+template<class Allocator>
+void benchTreeAllocator(const string& label, const vector<string>& words, const vector<string>& queries) {
+    AVLSearchTree<string_view, WordItem*, Allocator> tree;
+    auto start = chrono::high_resolution_clock::now();
+    for (const auto& word : words) tree.insert(word);
+    auto buildTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+
+    volatile size_t sink = 0;
+    start = chrono::high_resolution_clock::now();
+    for (const auto& query : queries) sink = sink + (tree.find(query) != nullptr);
+    auto lookupTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    start = chrono::high_resolution_clock::now();
+    tree.makeEmpty();
+    auto teardownTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+    cout << label << ": build " << buildTime.count() << " ms, lookup " << lookupTime.count() / queries.size()
+        << " ns, teardown " << teardownTime.count() << " ms\n";
+}
+
+// the AVL tree with one allocation per node against the slab arena
+int benchTree(int wordCount) {
+    vector<string> words(wordCount);
+    for (int i = 0; i < wordCount; i++) words[i] = syntheticWord(i);
+    shuffle(words.begin(), words.end(), mt19937(7));
+    vector<string> queries(words);
+    shuffle(queries.begin(), queries.end(), mt19937(42));
+    cout << "Inserting, looking up and destroying " << wordCount << " words\n";
+    benchTreeAllocator<NewDeleteAllocator<WordItem>>("new/delete", words, queries);
+    benchTreeAllocator<ArenaAllocator<WordItem>>("arena", words, queries);
+#ifdef COUNT_ALLOCATIONS
+    {
+        AVLSearchTree<string_view, WordItem*> tree;
+        for (const auto& word : words) tree.insert(word);
+        vector<string> capitalized(queries);
+        for (auto& query : capitalized) query[0] = static_cast<char>(toupper(static_cast<unsigned char>(query[0])));
+        volatile size_t sink = 0;
+        size_t before = allocationCount;
+        for (const auto& query : queries) sink = sink + (tree.find(query) != nullptr);
+        size_t lowerCase = allocationCount - before;
+        before = allocationCount;
+        for (const auto& query : capitalized) sink = sink + (tree.find(query) != nullptr);
+        size_t mixedCase = allocationCount - before;
+        cout << "heap allocations per find: " << static_cast<double>(lowerCase) / queries.size() << " lower case, "
+            << static_cast<double>(mixedCase) / queries.size() << " capitalized\n";
+    }
+#else
+    cout << "(build with -DCOUNT_ALLOCATIONS to count heap allocations per find)\n";
+#endif
+
+    // a skewed token stream, most tokens repeat a few hot words as in real text
+    vector<const string*> tokens(4 * static_cast<size_t>(wordCount));
+    mt19937 random(5);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (auto& token : tokens) token = &words[static_cast<size_t>(wordCount * pow(uniform(random), 4))];
+    cout << "Counting " << tokens.size() << " tokens\n";
+    // a word's position in words serves as its term
+    vector<vector<DocumentItem>> postings(wordCount);
+    {
+        AVLSearchTree<string_view, WordItem*> tree;
+        auto start = chrono::high_resolution_clock::now();
+        for (const string* token : tokens) {
+            WordItem* node = tree.find(*token);
+            if (!node) {
+                tree.insert(*token);
+                node = tree.find(*token);
+                node->term = static_cast<uint32_t>(token - words.data());
+            }
+            addPosting(postings[node->term], 0, 1);
+        }
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+        cout << "find, insert, find: " << elapsed.count() << " ms\n";
+    }
+    {
+        AVLSearchTree<string_view, WordItem*> tree;
+        auto start = chrono::high_resolution_clock::now();
+        for (const string* token : tokens) {
+            WordItem* node = tree.upsert(*token);
+            node->term = static_cast<uint32_t>(token - words.data());
+            addPosting(postings[node->term], 0, 1);
+        }
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+        cout << "upsert: " << elapsed.count() << " ms\n";
+    }
+    return 0;
+}
+
+// prefix queries of growing result counts on the tree, whole and cut at 10 words, against
+// filtering every word of the hash table
+int benchPrefix(int wordCount) {
+    SearchIndex index;
+    for (int i = 0; i < wordCount; i++) processWord(syntheticWord(i), index, 0);
+    const int rounds = 20;
+    cout << wordCount << " words\n";
+    for (string prefix : { "q", "qa", "qab", "qabc" }) {
+        size_t matches = 0;
+        auto countMatch = [&matches](const WordItem&) { matches++; };
+        auto start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) index.myTree.forEachWithPrefix(prefix, SIZE_MAX, countMatch);
+        auto allTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+        matches /= rounds;
+
+        volatile size_t sink = 0;
+        start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) sink = sink + index.myTree.forEachWithPrefix(prefix, 10, [](const WordItem&) {});
+        auto limitedTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+        start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            index.hash_table.forEach([&](const HashNode* node) {
+                if (node->word.compare(0, prefix.size(), prefix) == 0) sink = sink + 1;
+            });
+        }
+        auto scanTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+        cout << "prefix " << prefix << ": " << matches << " words, tree " << allTime.count() / rounds / 1000 << " us, first 10 "
+            << limitedTime.count() / rounds << " ns, hash table scan " << scanTime.count() / rounds / 1000 << " us\n";
+    }
+    return 0;
+}
+
+// Sustained churn on the hash table: every round removes a tenth of the words as one batch and
+// inserts as many new ones, and the probe lengths, tombstones and the cost of a lookup that
+// misses are printed along the way. Then times the tree's batch remove against one remove per word.
+int benchChurn(int wordCount) {
+    const int rounds = 50;
+    const int batch = max(1, wordCount / 10);
+    const int missCount = 100000;
+    // every word the benchmark will ever use, so the views held by the engines stay valid
+    vector<string> words(static_cast<size_t>(wordCount) + static_cast<size_t>(rounds) * batch + missCount);
+    for (size_t i = 0; i < words.size(); i++) words[i] = syntheticWord(static_cast<int>(i));
+    const string* misses = &words[words.size() - missCount];
+
+    HashTable<HashNode*, string_view> table;
+    vector<string_view> live;
+    for (int i = 0; i < wordCount; i++) {
+        table.insert(words[i], static_cast<uint32_t>(i));
+        live.push_back(words[i]);
+    }
+    size_t next = wordCount;
+    mt19937 random(11);
+    cout << wordCount << " words, " << batch << " removed and " << batch << " inserted per round\n";
+    for (int round = 1; round <= rounds; round++) {
+        shuffle(live.begin(), live.end(), random);
+        table.removeAll(live.end() - batch, live.end());
+        live.resize(live.size() - batch);
+        for (int i = 0; i < batch; i++, next++) {
+            table.insert(words[next], static_cast<uint32_t>(next));
+            live.push_back(words[next]);
+        }
+        if (round != 1 && round % 10 != 0) continue;
+
+        volatile size_t sink = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < missCount; i++) sink = sink + (table.find(misses[i]) != nullptr);
+        auto missTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+        double average;
+        int longest;
+        table.probeLengths(average, longest);
+        cout << "round " << round << ": table size " << table.getTableSize() << ", load " << table.loadFactor()
+            << ", " << table.getTombstoneCount() << " tombstones, probe length " << average << " average, "
+            << longest << " longest, missed lookup " << missTime.count() / missCount << " ns\n";
+    }
+
+    vector<string> sortedWords(words.begin(), words.begin() + wordCount);
+    shuffle(sortedWords.begin(), sortedWords.end(), mt19937(7));
+    for (int divisor : { 100, 10, 2 }) {
+        vector<string> removed(sortedWords.begin(), sortedWords.begin() + wordCount / divisor);
+        AVLSearchTree<string_view, WordItem*> oneByOne, batched;
+        for (const auto& word : sortedWords) {
+            oneByOne.insert(word);
+            batched.insert(word);
+        }
+        auto start = chrono::high_resolution_clock::now();
+        for (const auto& word : removed) oneByOne.remove(word);
+        auto oneByOneTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+        start = chrono::high_resolution_clock::now();
+        batched.removeAll(removed.begin(), removed.end());
+        auto batchTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+
+        auto it = batched.begin();
+        bool same = oneByOne.size() == batched.size();
+        for (auto expected = oneByOne.begin(); expected != oneByOne.end(); ++expected, ++it)
+            if (it == batched.end() || it->word != expected->word) same = false;
+        cout << "tree, removing " << removed.size() << " of " << wordCount << " words: one by one " << oneByOneTime.count()
+            << " ms, batch " << batchTime.count() << " ms" << (same ? ", same words left" : ", WORDS DIFFER") << "\n";
+    }
+    return 0;
+}
+
+// memory per word and random lookup latency of the radix tree against the AVL tree and the hash table
+int benchRadix(int wordCount) {
+    vector<string> words(wordCount);
+    for (int i = 0; i < wordCount; i++) words[i] = syntheticWord(i);
+    shuffle(words.begin(), words.end(), mt19937(7));
+    AVLSearchTree<string_view, WordItem*> tree;
+    HashTable<HashNode*, string_view> table;
+    TermStore terms;
+    AdaptiveRadixTree radix(terms);
+    for (size_t i = 0; i < words.size(); i++) {
+        tree.insert(words[i]);
+        table.insert(words[i], static_cast<uint32_t>(i));
+        radix.insert(words[i]);
+    }
+
+    // words of up to 15 letters live inline in their string, so only the structures are counted
+    cout << wordCount << " words, bytes per word without postings: AVL tree "
+        << static_cast<double>(wordCount * sizeof(WordItem)) / wordCount
+        << ", hash table " << static_cast<double>(table.memoryUsage()) / wordCount
+        << ", radix tree " << static_cast<double>(radix.memoryUsage()) / wordCount << "\n";
+
+    vector<string> queries(words);
+    shuffle(queries.begin(), queries.end(), mt19937(42));
+    benchLookupEngine("AVL tree", queries, [&](const string& q) { return tree.find(q) != nullptr; });
+    benchLookupEngine("hash table", queries, [&](const string& q) { return table.find(q) != nullptr; });
+    benchLookupEngine("radix tree", queries, [&](const string& q) { return radix.find(q) != nullptr; });
+
+    auto it = tree.begin();
+    bool ordered = true;
+    radix.forEach([&](const TermEntry* entry) {
+        if (it == tree.end() || it->word != entry->word) ordered = false;
+        else ++it;
+    });
+    cout << "radix tree iteration " << (ordered && it == tree.end() ? "matches the AVL tree's word order" : "DIFFERS from the AVL tree's word order") << "\n";
+
+    auto start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < wordCount; i += 2) radix.remove(queries[i]);
+    auto removeTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+    cout << "removing every other word: " << removeTime.count() << " ms, " << radix.size() << " words and "
+        << static_cast<double>(radix.memoryUsage()) / max<size_t>(1, radix.size()) << " bytes per word left\n";
+    return 0;
+}
+
+// distinct lowercase alphabetical words of a file, in order of first appearance
+vector<string> distinctWords(const string& filename) {
+    MappedFile file(filename);
+    TermStore terms;
+    FlatTable seen;
+    vector<string> words;
+    string word;
+    forEachToken(file.contents(), [&](string_view token) {
+        word.assign(token.data(), token.size());
+        for (char& c : word) c |= 0x20;
+        if (seen.find(word) == nullptr) {
+            uint32_t term = terms.add(word);
+            seen.insert(terms.word(term), term);
+            words.push_back(word);
+        }
+    });
+    return words;
+}
+
+// table size HashTable ends up with after inserting wordCount distinct words
+int finalTableSize(int wordCount) {
+    int tableSize = 53;
+    for (int count = 1; count <= wordCount; count++) {
+        if (static_cast<float>(count) / tableSize > 0.75) tableSize = nextPrime(2 * tableSize);
+    }
+    return tableSize;
+}
+
+// replays HashTable's quadratic probing over the given home slots and prints what it costs
+void reportProbes(const string& label, const vector<int>& homes, int tableSize, int fullCollisions, long long hashNs) {
+    vector<char> used(tableSize, 0);
+    long long totalProbes = 0;
+    int maxProbes = 0, homeCollisions = 0;
+    for (int home : homes) {
+        int collisionNum = 0;
+        long long currentPos = home;
+        while (used[currentPos]) {
+            ++collisionNum;
+            currentPos = (currentPos + static_cast<long long>(collisionNum) * collisionNum) % tableSize;
+        }
+        used[currentPos] = 1;
+        if (collisionNum > 0) homeCollisions++;
+        totalProbes += collisionNum + 1;
+        maxProbes = max(maxProbes, collisionNum + 1);
+    }
+    cout << "  " << label << ": " << homeCollisions << " slot collisions, "
+        << fullCollisions << " full hash collisions, average probe length "
+        << static_cast<double>(totalProbes) / homes.size() << ", longest probe " << maxProbes
+        << ", " << static_cast<double>(hashNs) / homes.size() << " ns per hash\n";
+}
+
+// compares the original hash_function with word_hash on the words of each file
+int benchHash(const vector<string>& filenames) {
+    for (const auto& filename : filenames) {
+        vector<string> words = distinctWords(filename);
+        if (words.empty()) {
+            cout << filename << ": no words\n";
+            continue;
+        }
+        int tableSize = finalTableSize(words.size());
+        cout << filename << ": " << words.size() << " distinct words, table size " << tableSize << "\n";
+
+        vector<int> legacyHomes, newHomes;
+        auto start = chrono::high_resolution_clock::now();
+        for (const auto& word : words) legacyHomes.push_back(hash_function(word, tableSize));
+        long long legacyNs = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count();
+        start = chrono::high_resolution_clock::now();
+        for (const auto& word : words) newHomes.push_back(word_hash(word) % tableSize);
+        long long newNs = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count();
+
+        // full width values before the modulo, equal values can only be told apart by a string compare
+        vector<unsigned> legacyFull;
+        vector<uint64_t> newFull;
+        for (const auto& word : words) {
+            unsigned hashVal = 0;
+            for (char ch : word) hashVal = 37 * hashVal + ch;
+            legacyFull.push_back(hashVal);
+            newFull.push_back(word_hash(word));
+        }
+
+        sort(legacyFull.begin(), legacyFull.end());
+        sort(newFull.begin(), newFull.end());
+        int legacyCollisions = legacyFull.end() - unique(legacyFull.begin(), legacyFull.end());
+        int newCollisions = newFull.end() - unique(newFull.begin(), newFull.end());
+        reportProbes("hash_function (37 * h + ch, 32 bit)", legacyHomes, tableSize, legacyCollisions, legacyNs);
+        reportProbes("word_hash (64 bit)", newHomes, tableSize, newCollisions, newNs);
+    }
+    return 0;
+}
+
+bool sameDetails(const vector<DocumentItem>& a, const vector<DocumentItem>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].documentId != b[i].documentId || a[i].count != b[i].count) return false;
+    return true;
+}
+
+// true when every engine of actual holds exactly the postings of expected, in the same order
+bool sameIndex(const SearchIndex& expected, const SearchIndex& actual) {
+    if (expected.hash_table.getUniqueWordCount() != actual.hash_table.getUniqueWordCount() ||
+        expected.flat_table.getUniqueWordCount() != actual.flat_table.getUniqueWordCount())
+        return false;
+    bool same = true;
+    // term ids depend on the build order, so only the words and postings they lead to are compared
+    expected.hash_table.forEach([&](const HashNode* node) {
+        const HashNode* hashNode = actual.hash_table.find(node->word);
+        const WordItem* treeNode = actual.myTree.find(node->word);
+        const FlatEntry* flatEntry = actual.flat_table.find(node->word);
+        if (!hashNode || !treeNode || !flatEntry || hashNode->term != treeNode->term || hashNode->term != flatEntry->term ||
+            actual.terms.word(hashNode->term) != node->word ||
+            !sameDetails(expected.terms.postings(node->term), actual.terms.postings(hashNode->term)))
+            same = false;
+    });
+    return same;
+}
+
+// Compares the positional index with the plain counts index: size, and the latency of phrase
+// queries against the word-level AND the counts index can answer. Phrases are two and three
+// word windows taken from the first file.
+int benchPhrase(const vector<string>& filenames) {
+    DocumentTable documents;
+    SearchIndex index;
+    index.positions.reset(new PositionalIndex());
+    ingestFiles(filenames, documents, index, 1);
+
+    size_t postings = index.terms.postingCount();
+    cout << "counts index: " << postings * sizeof(DocumentItem) << " bytes of postings\n";
+    cout << "positional index: " << index.positions->sizeInBytes() << " bytes of postings\n";
+
+    vector<vector<string>> phrases;
+    MappedFile file(filenames.empty() ? string() : filenames[0]);
+    vector<string> tokens;
+    forEachToken(file.contents(), [&](string_view token) {
+        string word(token);
+        for (char& c : word) c |= 0x20;
+        tokens.push_back(word);
+    });
+    for (size_t i = 0; i + 3 <= tokens.size(); i += 37) {
+        phrases.push_back(vector<string>(tokens.begin() + i, tokens.begin() + i + 2 + i % 2));
+    }
+    if (phrases.empty()) {
+        cout << "no phrases to query\n";
+        return 0;
+    }
+
+    volatile size_t sink = 0;
+    auto start = chrono::high_resolution_clock::now();
+    for (const auto& phrase : phrases) {
+        sink = sink + index.positions->phraseQuery(phrase).size();
+    }
+    auto phraseTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    start = chrono::high_resolution_clock::now();
+    for (const auto& phrase : phrases) {
+        vector<uint32_t> matching;
+        bool first = true;
+        for (const auto& word : phrase) {
+            const FlatEntry* entry = index.flat_table.find(word);
+            vector<uint32_t> documentIds;
+            if (entry)
+                for (const auto& detail : index.terms.postings(entry->term)) documentIds.push_back(detail.documentId);
+            if (first) matching = documentIds;
+            else {
+                vector<uint32_t> both;
+                set_intersection(matching.begin(), matching.end(), documentIds.begin(), documentIds.end(), back_inserter(both));
+                matching.swap(both);
+            }
+            first = false;
+        }
+        sink = sink + matching.size();
+    }
+    auto andTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    cout << phrases.size() << " phrases\n";
+    cout << "phrase query (positional index): " << phraseTime.count() / phrases.size() << " ns per query\n";
+    cout << "word AND query (counts index): " << andTime.count() / phrases.size() << " ns per query\n";
+    return 0;
+}
+
+// One rare and several common words over a synthetic collection: the old collect-everything
+// path, a plain linear merge, and intersectPostings, which must agree with the merge.
+int benchIntersect(int documentCount) {
+    mt19937 random(7);
+    auto makeList = [&](double density) {
+        vector<DocumentItem> list;
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        for (int id = 0; id < documentCount; id++)
+            if (coin(random) < density) list.push_back({ static_cast<uint32_t>(id), 1 });
+        return list;
+    };
+    vector<vector<DocumentItem>> lists = { makeList(0.5), makeList(0.3), makeList(0.4), makeList(20.0 / documentCount) };
+    vector<PostingSpan> spans;
+    for (const auto& list : lists) spans.push_back(spanOf(list));
+    const int rounds = 20;
+
+    auto start = chrono::high_resolution_clock::now();
+    size_t collected = 0;
+    for (int r = 0; r < rounds; r++) {
+        map<uint32_t, int> seen;
+        for (const auto& list : lists)
+            for (const auto& detail : list) seen[detail.documentId]++;
+        for (const auto& entry : seen) collected += entry.second == static_cast<int>(lists.size());
+    }
+    auto collectTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    start = chrono::high_resolution_clock::now();
+    vector<uint32_t> merged;
+    for (int r = 0; r < rounds; r++) {
+        merged.clear();
+        for (const auto& detail : lists[0]) merged.push_back(detail.documentId);
+        for (size_t l = 1; l < lists.size(); l++) {
+            vector<uint32_t> ids, both;
+            for (const auto& detail : lists[l]) ids.push_back(detail.documentId);
+            set_intersection(merged.begin(), merged.end(), ids.begin(), ids.end(), back_inserter(both));
+            merged.swap(both);
+        }
+    }
+    auto mergeTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    start = chrono::high_resolution_clock::now();
+    vector<uint32_t> galloped;
+    for (int r = 0; r < rounds; r++) galloped = intersectPostings(spans);
+    auto gallopTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    cout << "list lengths";
+    for (const auto& list : lists) cout << " " << list.size();
+    cout << ", " << galloped.size() << " documents match\n";
+    cout << "collect every posting into a map: " << collectTime.count() / rounds / 1000 << " us\n";
+    cout << "linear merge: " << mergeTime.count() / rounds / 1000 << " us\n";
+    cout << "galloping intersection: " << gallopTime.count() / rounds / 1000 << " us"
+        << (galloped == merged && collected == merged.size() * rounds ? "" : " (RESULTS DIFFER)") << "\n";
+
+    // gallopTo against a plain lower bound from random starts, and every 8-wide compare it makes
+    // against the scalar count over the same postings
+    size_t lookups = 0, blocks = 0, differences = 0;
+    uniform_int_distribution<int> targetOf(0, documentCount);
+    for (const auto& span : spans) {
+        uniform_int_distribution<size_t> startOf(0, span.size);
+        for (int i = 0; i < 10000; i++) {
+            size_t from = startOf(random);
+            uint32_t target = static_cast<uint32_t>(targetOf(random));
+            size_t expected = lower_bound(span.items + from, span.items + span.size, target,
+                [](const DocumentItem& item, uint32_t id) { return item.documentId < id; }) - span.items;
+            differences += gallopTo(span, from, target, &blocks) != expected;
+            if (from + 8 <= span.size)
+                differences += countBelow8(span.items + from, target) != countBelowScalar(span.items + from, 8, target);
+            lookups++;
+        }
+    }
+#ifdef HAVE_SSE2
+    const char* blockPath = "SSE2";
+#else
+    const char* blockPath = "scalar";
+#endif
+    cout << "checked " << lookups << " lookups: " << blocks << " " << blockPath << " block compares"
+        << (differences == 0 && blocks > 0 ? "" : " (RESULTS DIFFER)") << "\n";
+    return 0;
+}
+
+// MaxScore against exhaustive scoring on a synthetic collection with one rare, two medium and
+// two common words; both must return the same ranking.
+int benchRank(int documentCount, size_t k) {
+    mt19937 random(11);
+    DocumentTable documents;
+    uniform_int_distribution<int> lengthOf(50, 1000);
+    for (int id = 0; id < documentCount; id++) {
+        uint32_t documentId = documents.getId("doc" + to_string(id));
+        documents.addLength(documentId, lengthOf(random));
+    }
+    geometric_distribution<int> countOf(0.4);
+    vector<vector<DocumentItem>> lists;
+    vector<RankedTerm> terms;
+    for (double density : { 0.0005, 0.05, 0.08, 0.4, 0.6 }) {
+        vector<DocumentItem> list;
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        for (int id = 0; id < documentCount; id++)
+            if (coin(random) < density) list.push_back({ static_cast<uint32_t>(id), 1 + countOf(random) });
+        lists.push_back(list);
+    }
+    for (const auto& list : lists) {
+        int maxCount = 0;
+        for (const auto& detail : list) maxCount = max(maxCount, detail.count);
+        terms.push_back({ spanOf(list), maxCount });
+    }
+    const int rounds = 10;
+
+    vector<ScoredDocument> exhaustive, maxScore;
+    auto start = chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; r++) exhaustive = rankExhaustive(terms, documents, k);
+    auto exhaustiveTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+    start = chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; r++) maxScore = rankTopK(terms, documents, k);
+    auto maxScoreTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+
+    bool same = exhaustive.size() == maxScore.size();
+    for (size_t i = 0; same && i < exhaustive.size(); i++)
+        same = exhaustive[i].documentId == maxScore[i].documentId && fabs(exhaustive[i].score - maxScore[i].score) < 1e-9;
+    cout << documentCount << " documents, list lengths";
+    for (const auto& list : lists) cout << " " << list.size();
+    cout << ", top " << k << "\n";
+    cout << "exhaustive scoring: " << exhaustiveTime.count() / rounds << " us\n";
+    cout << "MaxScore: " << maxScoreTime.count() / rounds << " us" << (same ? ", same ranking" : ", RANKING DIFFERS") << "\n";
+    return 0;
+}
+
+// replays a skewed stream of queries through the result cache and reports its hit ratio and
+// the latencies of hits and misses, next to the same stream answered without a cache
+int benchCache(int queryCount, size_t cacheBytes) {
+    const int documentCount = 2000, vocabulary = 20000, wordsPerDocument = 300, distinctQueries = 50000;
+    mt19937 random(5);
+    DocumentTable documents;
+    SearchIndex index;
+    vector<string> words(vocabulary);
+    for (int i = 0; i < vocabulary; i++) words[i] = syntheticWord(i);
+    // word i turns up about 1/(i+1) as often as word 0
+    vector<double> weights(vocabulary);
+    for (int i = 0; i < vocabulary; i++) weights[i] = 1.0 / (i + 1);
+    discrete_distribution<int> wordOf(weights.begin(), weights.end());
+    for (int d = 0; d < documentCount; d++) {
+        uint32_t documentId = documents.getId("doc" + to_string(d));
+        map<int, int> counts;
+        for (int t = 0; t < wordsPerDocument; t++) counts[wordOf(random)]++;
+        for (const auto& count : counts) processWord(words[count.first], index, documentId, count.second);
+        documents.addLength(documentId, wordsPerDocument);
+    }
+
+    // queries of one to three words, the stream repeating popular ones the same way
+    uniform_int_distribution<int> lengthOf(1, 3);
+    vector<vector<string>> pool(distinctQueries);
+    for (auto& query : pool)
+        for (int w = lengthOf(random); w > 0; w--) query.push_back(words[100 + wordOf(random) % 2000]);
+    vector<double> popularity(distinctQueries);
+    for (int i = 0; i < distinctQueries; i++) popularity[i] = 1.0 / (i + 1);
+    discrete_distribution<int> queryOf(popularity.begin(), popularity.end());
+    vector<int> stream(queryCount);
+    for (auto& q : stream) q = queryOf(random);
+
+    auto nameOf = [&documents](uint32_t id) { return documents.name(id); };
+    auto lookup = [&index](const string& word, PostingSpan& span) {
+        const FlatEntry* entry = index.flat_table.find(word);
+        if (entry) span = spanOf(index.terms.postings(entry->term));
+        return entry != nullptr;
+    };
+    volatile size_t sink = 0;
+    auto replay = [&](QueryCache<CachedResults>& cache) {
+        for (int q : stream) {
+            auto start = chrono::high_resolution_clock::now();
+            const vector<string>& queryWords = pool[q];
+            vector<string> terms = QueryCache<CachedResults>::normalize(queryWords);
+            string key = QueryCache<CachedResults>::keyOf(terms);
+            const CachedResults* cached = cache.find(key);
+            CachedResults computed;
+            if (!cached) computed.allWordsFound = conjunctiveResults(terms, lookup, nameOf, computed.results);
+            const CachedResults& answer = cached ? *cached : computed;
+            sink = sink + answer.results.size();
+            if (!cached) {
+                size_t answerBytes = computed.memoryUsage();
+                cache.insert(key, terms, move(computed), answerBytes);
+            }
+            cache.recordLatency(cached != nullptr, chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count());
+        }
+    };
+
+    cout << queryCount << " queries drawn from " << distinctQueries << " distinct ones over "
+        << documentCount << " documents\n";
+    QueryCache<CachedResults> uncached(0);
+    replay(uncached);
+    cout << "without a cache:\n";
+    uncached.printStats(cout);
+    QueryCache<CachedResults> cache(cacheBytes);
+    replay(cache);
+    cout << "with a " << cacheBytes << " byte cache:\n";
+    cache.printStats(cout);
+    size_t entries = cache.size();
+    size_t dropped = cache.invalidate(words[100]);
+    cout << "changing \"" << words[100] << "\" drops " << dropped << " of " << entries << " entries\n";
+    return 0;
+}
+
+// the same tree evaluated without a plan: every operand read whole and combined in the order written
+vector<uint32_t> evaluateMaterialized(const QueryNode& node, size_t documentCount, size_t& postingsTouched) {
+    vector<uint32_t> documents;
+    if (node.kind == QueryNode::TERM || node.kind == QueryNode::PHRASE) {
+        for (const auto& span : node.postings) postingsTouched += span.size;
+        return intersectPostings(node.postings);
+    }
+    if (node.kind == QueryNode::NOT) {
+        vector<uint32_t> excluded = evaluateMaterialized(*node.children[0], documentCount, postingsTouched);
+        for (uint32_t id = 0; id < documentCount; id++)
+            if (!binary_search(excluded.begin(), excluded.end(), id)) documents.push_back(id);
+        return documents;
+    }
+    for (size_t i = 0; i < node.children.size(); i++) {
+        vector<uint32_t> operand = evaluateMaterialized(*node.children[i], documentCount, postingsTouched), combined;
+        if (i == 0) combined = operand;
+        else if (node.kind == QueryNode::AND) set_intersection(documents.begin(), documents.end(), operand.begin(), operand.end(), back_inserter(combined));
+        else set_union(documents.begin(), documents.end(), operand.begin(), operand.end(), back_inserter(combined));
+        documents.swap(combined);
+    }
+    return documents;
+}
+
+template<class Lookup>
+void resolvePostings(QueryNode& node, Lookup lookup) {
+    for (const auto& word : node.words) {
+        PostingSpan span = { nullptr, 0 };
+        if (!lookup(word, span)) span = { nullptr, 0 };
+        node.postings.push_back(span);
+    }
+    for (auto& child : node.children) resolvePostings(*child, lookup);
+}
+
+// boolean queries over words of very different frequency, planned and unplanned
+int benchBoolean(int documentCount) {
+    mt19937 random(3);
+    SearchIndex index;
+    const vector<pair<string, double>> densities = { { "rare", 0.001 }, { "uncommon", 0.02 }, { "common", 0.2 },
+        { "frequent", 0.5 }, { "everywhere", 0.95 } };
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    for (int id = 0; id < documentCount; id++)
+        for (const auto& word : densities)
+            if (coin(random) < word.second) processWord(word.first, index, id, 1);
+    auto lookup = [&index](const string& word, PostingSpan& span) {
+        const FlatEntry* entry = index.flat_table.find(word);
+        if (entry) span = spanOf(index.terms.postings(entry->term));
+        return entry != nullptr;
+    };
+
+    cout << documentCount << " documents\n";
+    const int rounds = 20;
+    for (string query : { "everywhere AND frequent AND rare", "frequent AND NOT everywhere AND uncommon",
+        "(common OR frequent) AND NOT everywhere AND rare", "NOT (everywhere OR frequent) AND common" }) {
+        QueryParser parser;
+        string error;
+        unique_ptr<QueryNode> root = parser.parse(query, error);
+        planQuery(root, lookup, documentCount);
+        // the unplanned baseline keeps the operands in the order the query has them
+        unique_ptr<QueryNode> written = parser.parse(query, error);
+        resolvePostings(*written, lookup);
+
+        vector<uint32_t> planned, materialized;
+        size_t plannedTouched = 0, materializedTouched = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            QueryEvaluator evaluator(documentCount, nullptr);
+            planned = evaluator.evaluate(*root);
+            plannedTouched = evaluator.getPostingsTouched();
+        }
+        auto plannedTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+        start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            materializedTouched = 0;
+            materialized = evaluateMaterialized(*written, documentCount, materializedTouched);
+        }
+        auto materializedTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+
+        cout << query << ": " << planned.size() << " documents" << (planned == materialized ? "" : ", RESULTS DIFFER") << "\n"
+            << "  planned: " << plannedTime.count() / rounds << " us, " << plannedTouched << " postings touched\n"
+            << "  as written: " << materializedTime.count() / rounds << " us, " << materializedTouched << " postings touched\n";
+    }
+    return 0;
+}
+
+// conjunctive queries on very common words, answered by one index and by 2 to 8 shards fanned out
+int benchShards(int documentCount) {
+    mt19937 random(9);
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    const vector<pair<string, double>> densities = { { "everywhere", 0.95 }, { "common", 0.6 }, { "frequent", 0.4 }, { "rare", 0.001 } };
+    // the same documents, with the same counts, for every shard count
+    vector<vector<pair<int, int>>> documentWords(documentCount);
+    geometric_distribution<int> countOf(0.3);
+    for (auto& words : documentWords)
+        for (size_t w = 0; w < densities.size(); w++)
+            if (coin(random) < densities[w].second) words.push_back({ static_cast<int>(w), 1 + countOf(random) });
+
+    const vector<string> queries = { "everywhere", "everywhere common", "common frequent", "everywhere rare" };
+    const int rounds = 5;
+    cout << documentCount << " documents, " << thread::hardware_concurrency() << " hardware threads\n";
+    vector<string> reference;
+    for (size_t shardCount : { 1, 2, 4, 8 }) {
+        ShardedIndex sharded(shardCount);
+        for (int d = 0; d < documentCount; d++) {
+            // padded names sort in document order, so consecutive documents form the name ranges
+            IndexShard& shard = sharded.shard(static_cast<size_t>(d) * shardCount / documentCount);
+            string number = to_string(d);
+            uint32_t documentId = shard.documents.getId("doc" + string(8 - min<size_t>(8, number.size()), '0') + number);
+            for (const auto& word : documentWords[d]) processWord(densities[word.first].first, shard.index, documentId, word.second);
+        }
+        sharded.freeze();
+        TaskPool pool(static_cast<int>(shardCount) - 1);
+
+        cout << shardCount << (shardCount == 1 ? " shard:" : " shards:");
+        for (size_t q = 0; q < queries.size(); q++) {
+            string answer;
+            auto start = chrono::high_resolution_clock::now();
+            for (int r = 0; r < rounds; r++) answer = answerSharded(queries[q], sharded, pool);
+            auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+            if (shardCount == 1) reference.push_back(answer);
+            cout << " \"" << queries[q] << "\" " << elapsed.count() / rounds / 1000.0 << " ms"
+                << (answer == reference[q] ? "" : " (ANSWER DIFFERS)") << (q + 1 < queries.size() ? "," : "\n");
+        }
+    }
+    return 0;
+}
+
+// builds the tree from a sorted vocabulary insert by insert and by bulk load
+int benchBulk(int wordCount) {
+    TermStore terms;
+    vector<TermEntry> vocabulary(wordCount);
+    for (int i = 0; i < wordCount; i++) {
+        uint32_t term = terms.add(syntheticWord(i));
+        vocabulary[i] = { terms.word(term), term };
+    }
+    sort(vocabulary.begin(), vocabulary.end(), [](const TermEntry& a, const TermEntry& b) { return a.word < b.word; });
+    cout << "Building from " << wordCount << " sorted words\n";
+
+    // the shard merge used to insert words in hash table order
+    vector<TermEntry> shuffledVocabulary(vocabulary);
+    shuffle(shuffledVocabulary.begin(), shuffledVocabulary.end(), mt19937(3));
+    chrono::milliseconds shuffledTime;
+    auto start = chrono::high_resolution_clock::now();
+    {
+        AVLSearchTree<string_view, WordItem*> shuffled;
+        for (const auto& entry : shuffledVocabulary) shuffled.upsert(entry.word)->term = entry.term;
+        shuffledTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+    }
+
+    AVLSearchTree<string_view, WordItem*> inserted;
+    start = chrono::high_resolution_clock::now();
+    for (const auto& entry : vocabulary) inserted.upsert(entry.word)->term = entry.term;
+    auto insertTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+
+    AVLSearchTree<string_view, WordItem*> loaded;
+    start = chrono::high_resolution_clock::now();
+    loaded.bulkLoad(vocabulary.begin(), vocabulary.end());
+    auto loadTime = chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - start);
+
+    auto it = loaded.begin();
+    bool same = true;
+    for (auto expected = inserted.begin(); expected != inserted.end(); ++expected, ++it)
+        if (it == loaded.end() || it->word != expected->word || it->term != expected->term) same = false;
+    cout << "insert by insert, random order: " << shuffledTime.count() << " ms\n";
+    cout << "insert by insert, sorted order: " << insertTime.count() << " ms\n";
+    cout << "bulk load: " << loadTime.count() << " ms" << (same && it == loaded.end() ? ", same tree contents" : ", CONTENTS DIFFER") << "\n";
+    return 0;
+}
+
+// times the serial build against parallel builds with growing thread counts
+int benchIngest(const vector<string>& filenames) {
+    int maxThreads = max<int>(4, thread::hardware_concurrency());
+    DocumentTable documents;
+    SearchIndex serial;
+    size_t residentBefore = residentBytes();
+    auto start = chrono::high_resolution_clock::now();
+    size_t bytes = ingestFiles(filenames, documents, serial, 1);
+    auto serialTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+    size_t postings = serial.terms.postingCount();
+    cout << filenames.size() << " files, " << bytes << " bytes, " << postings << " postings of "
+        << sizeof(DocumentItem) << " bytes\n";
+    cout << "1 thread: " << serialTime.count() / 1000.0 << " ms, resident memory " << residentBefore / (1024 * 1024)
+        << " MB before and " << residentBytes() / (1024 * 1024) << " MB after, term store "
+        << serial.terms.memoryUsage() / (1024 * 1024) << " MB\n";
+
+    for (int threads = 2; threads <= maxThreads; threads *= 2) {
+        DocumentTable parallelDocuments;
+        SearchIndex parallel;
+        start = chrono::high_resolution_clock::now();
+        ingestFiles(filenames, parallelDocuments, parallel, threads);
+        auto parallelTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+        cout << threads << " threads: " << parallelTime.count() / 1000.0 << " ms, speed up "
+            << static_cast<double>(serialTime.count()) / max<long long>(1, parallelTime.count())
+            << (sameIndex(serial, parallel) ? ", matches serial build" : ", DIFFERS from serial build") << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench-rehash") {
+        return benchRehash(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-lookup") {
+        return benchLookup(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-tree") {
+        return benchTree(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-prefix") {
+        return benchPrefix(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-churn") {
+        return benchChurn(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-radix") {
+        return benchRadix(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-bulk") {
+        return benchBulk(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-hash") {
+        vector<string> files(argv + 2, argv + argc);
+        if (files.empty()) files = { "a.txt", "b.txt", "c.txt" };
+        return benchHash(files);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-intersect") {
+        return benchIntersect(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-rank") {
+        return benchRank(argc > 2 ? stoi(argv[2]) : 1000000, argc > 3 ? stoi(argv[3]) : 10);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-cache") {
+        return benchCache(argc > 2 ? stoi(argv[2]) : 100000, argc > 3 ? stoull(argv[3]) : 16 << 20);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-boolean") {
+        return benchBoolean(argc > 2 ? stoi(argv[2]) : 1000000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-shards") {
+        return benchShards(argc > 2 ? stoi(argv[2]) : 200000);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-phrase") {
+        return benchPhrase(vector<string>(argv + 2, argv + argc));
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-ingest") {
+        return benchIngest(vector<string>(argv + 2, argv + argc));
+    }
+
+    int threadCount = 1;
+    bool withPositions = false;
+    size_t topK = 0;
+    size_t wordLimit = 10;
+    size_t cacheBytes = 16 << 20;
+    int workerCount = max(1u, thread::hardware_concurrency());
+    size_t shardCount = 1;
+    bool jsonOutput = false;
+    string buildPath, servePath, socketPath, batchPath, outputPath;
+    vector<string> inputFiles;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threadCount = max(1, stoi(argv[++i]));
+        else if (arg == "--positions") withPositions = true;
+        else if (arg == "--top" && i + 1 < argc) topK = max(0, stoi(argv[++i]));
+        else if (arg == "--limit" && i + 1 < argc) wordLimit = max(1, stoi(argv[++i]));
+        else if (arg == "--build-index" && i + 1 < argc) buildPath = argv[++i];
+        else if (arg == "--serve-index" && i + 1 < argc) servePath = argv[++i];
+        else if (arg == "--cache-bytes" && i + 1 < argc) cacheBytes = stoull(argv[++i]);
+        else if (arg == "--serve-socket" && i + 1 < argc) socketPath = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc) workerCount = max(1, stoi(argv[++i]));
+        else if (arg == "--shards" && i + 1 < argc) shardCount = max(1, stoi(argv[++i]));
+        else if (arg == "--batch" && i + 1 < argc) batchPath = argv[++i];
+        else if (arg == "--output" && i + 1 < argc) outputPath = argv[++i];
+        else if (arg == "--format" && i + 1 < argc) jsonOutput = string(argv[++i]) == "jsonl";
+        else inputFiles.push_back(arg);
+    }
+    if (!buildPath.empty()) {
+        return buildIndex(buildPath, inputFiles, threadCount);
+    }
+    if (!batchPath.empty()) {
+        return batchQueries(batchPath, outputPath, jsonOutput, servePath, inputFiles, threadCount, workerCount, withPositions);
+    }
+    if (!socketPath.empty()) {
+        return serveSocket(socketPath, servePath, inputFiles, threadCount, workerCount, withPositions, shardCount);
+    }
+    if (!servePath.empty()) {
+        return serveIndex(servePath, cacheBytes);
+    }
+
+    DocumentTable documents;
+    SearchIndex index;
+    if (withPositions) index.positions.reset(new PositionalIndex());
+    AVLSearchTree<string_view, WordItem*>& myTree = index.myTree;
+    HashTable<HashNode*, string_view>& hash_table = index.hash_table;
+    FlatTable& flat_table = index.flat_table;
+    int fileNum;
+    cout << "Enter number of input files: ";
+    cin >> fileNum;
+    vector<string> filenames(fileNum);
+    for (int i = 0; i < fileNum; ++i) {
+        cout << "Enter " << i + 1 << ". file name: ";
+        cin >> filenames[i];
+    }
+
+    auto ingestStart = chrono::high_resolution_clock::now();
+    size_t ingestedBytes = ingestFiles(filenames, documents, index, threadCount);
+    auto ingestTime = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - ingestStart);
+
+    cout << "After preprocessing, the unique word count is " << hash_table.getUniqueWordCount() << ". Current load ratio is " << hash_table.loadFactor() << "\n";
+    cout << "Ingested " << ingestedBytes << " bytes in " << ingestTime.count() / 1000.0 << " ms ("
+        << (ingestTime.count() > 0 ? ingestedBytes / static_cast<double>(ingestTime.count()) : 0.0) << " MB/s)\n";
+
+    // the tree is read-only from here on, queries are served from its frozen copy
+    FrozenDictionary frozen;
+    frozen.freeze(myTree, index.terms);
+
+    string search;
+    cout << "Enter queried words in one line: ";
+    cin.ignore();
+    getline(cin, search);
+
+    // AND, OR and NOT are told from words by their capitals, so they are looked for first
+    bool isBoolean = isBooleanQuery(search);
+    string booleanSearch = search;
+
+    // Convert the entire input string to lowercase
+    search = tolower_string(search);
+
+    vector<string> queryWords = splitWords(search);
+
+    // Store results in maps for grouped output
+    map<string, map<string, int>> bstResults;
+    map<string, map<string, int>> hashTableResults;
+
+    // Only the postings lists are looked up here; intersectPostings then walks them starting
+    // from the rarest word, and counts are read for the surviving documents only
+    auto nameOf = [&documents](uint32_t id) { return documents.name(id); };
+
+    // Collect results for AVL Tree, through the frozen copy
+    bool allWordsFoundInBST = conjunctiveResults(queryWords, [&frozen](const string& word, PostingSpan& span) {
+        return frozen.find(word, span);
+    }, nameOf, bstResults);
+
+    // Collect results for Hash Table
+    bool allWordsFoundInHashTable = conjunctiveResults(queryWords, [&hash_table, &index](const string& word, PostingSpan& span) {
+        const HashNode* foundNode = hash_table.find(word);
+        if (foundNode) span = spanOf(index.terms.postings(foundNode->term));
+        return foundNode != nullptr;
+    }, nameOf, hashTableResults);
+
+    // "katn*" lists the words starting with katn and "from..to" the words between the two, from the
+    // sorted tree, at most --limit of them
+    size_t star = search.find('*');
+    size_t dots = search.find("..");
+    bool isDictionaryQuery = star != string::npos || dots != string::npos;
+    auto wordBefore = [&search](size_t end) {
+        size_t begin = end;
+        while (begin > 0 && isalpha(static_cast<unsigned char>(search[begin - 1]))) begin--;
+        return search.substr(begin, end - begin);
+    };
+    auto wordAfter = [&search](size_t begin) {
+        size_t end = begin;
+        while (end < search.size() && isalpha(static_cast<unsigned char>(search[end]))) end++;
+        return search.substr(begin, end - begin);
+    };
+    if (isBoolean) {
+        answerBooleanQuery(booleanSearch, [&flat_table, &index](const string& word, PostingSpan& span) {
+            const FlatEntry* entry = flat_table.find(word);
+            if (entry) span = spanOf(index.terms.postings(entry->term));
+            return entry != nullptr;
+        }, nameOf, documents.size(), index.positions.get());
+    }
+    else if (isDictionaryQuery) {
+        // one extra word tells whether the limit cut the list short
+        vector<const WordItem*> matches;
+        auto collect = [&matches](const WordItem& item) { matches.push_back(&item); };
+        if (star != string::npos) myTree.forEachWithPrefix(wordBefore(star), wordLimit + 1, collect);
+        else myTree.forEachInRange(wordBefore(dots), wordAfter(dots + 2), wordLimit + 1, collect);
+
+        if (matches.empty()) {
+            cout << "No word matches the given query\n";
+        }
+        for (size_t i = 0; i < matches.size() && i < wordLimit; i++) {
+            const vector<DocumentItem>& details = index.terms.postings(matches[i]->term);
+            int total = 0;
+            for (const auto& detail : details) total += detail.count;
+            cout << matches[i]->word << " found " << total << " times in " << details.size() << " documents.\n";
+        }
+        if (matches.size() > wordLimit) {
+            cout << "More words match, --limit raises the " << wordLimit << " shown.\n";
+        }
+    }
+    else if (topK > 0) {
+        // --top k ranks every document holding any of the words by BM25
+        vector<RankedTerm> terms;
+        vector<string> seen;
+        for (const auto& query : queryWords) {
+            if (query == "\n" || find(seen.begin(), seen.end(), query) != seen.end()) continue;
+            seen.push_back(query);
+            const FlatEntry* entry = flat_table.find(query);
+            if (entry) terms.push_back({ spanOf(index.terms.postings(entry->term)), index.terms.maxCount(entry->term) });
+        }
+        vector<ScoredDocument> ranking = rankTopK(terms, documents, topK);
+        if (ranking.empty()) {
+            cout << "No document contains the given query\n";
+        }
+        for (size_t i = 0; i < ranking.size(); i++) {
+            cout << i + 1 << ". in Document " << documents.name(ranking[i].documentId) << ", score " << ranking[i].score << ".\n";
+        }
+    }
+    else {
+        // Print the results for AVL Tree
+        printResults(bstResults, allWordsFoundInBST);
+
+        // Print the results for Hash Table
+        printResults(hashTableResults, allWordsFoundInHashTable);
+    }
+
+    int k = 20;
+    // lookups without observable effects would be optimized away, the sink keeps them
+    volatile size_t sink = 0;
+    auto start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < k; ++i) {
+        for (const auto& query : queryWords) {
+            sink = sink + (myTree.find(query) != nullptr);
+        }
+    }
+    auto BSTTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < k; ++i) {
+        for (const auto& query : queryWords) {
+            sink = sink + (hash_table.find(query) != nullptr);
+        }
+    }
+    auto HTTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    cout << "Time: " << BSTTime.count() / k << " ns\n";
+    start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < k; ++i) {
+        for (const auto& query : queryWords) {
+            sink = sink + (flat_table.find(query) != nullptr);
+        }
+    }
+    auto FlatTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    cout << "Time: " << HTTime.count() / k << " ns\n";
+    cout << "Speed Up: " << static_cast<float>(BSTTime.count()) / HTTime.count() << "\n";
+    start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < k; ++i) {
+        for (const auto& query : queryWords) {
+            PostingSpan span;
+            sink = sink + frozen.find(query, span);
+        }
+    }
+    auto FrozenTime = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start);
+
+    cout << "Flat Table Time: " << FlatTime.count() / k << " ns\n";
+    cout << "Speed Up: " << static_cast<float>(BSTTime.count()) / FlatTime.count() << "\n";
+    cout << "Frozen Dictionary Time: " << FrozenTime.count() / k << " ns\n";
+    cout << "Speed Up: " << static_cast<float>(BSTTime.count()) / FrozenTime.count() << "\n";
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Load generator for the --serve-socket mode of the search program. Every connection runs on
+// its own thread and keeps depth queries in flight, each answer ends with an empty line.
+// Queries come from a file, one per line, and are cycled through.
+//   loadgen socket queries.txt [--connections N] [--depth D] [--requests N]
+// Reports queries per second and latency percentiles over all the answers.
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <deque>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct ConnectionResult {
+    vector<long long> latencies;   // nanoseconds from sending a query to the end of its answer
+    bool failed = false;
+};
+
+int connectTo(const string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return -1;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const string& text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// sends requests queries starting at queries[first], never more than depth unanswered
+void runConnection(const string& path, const vector<string>& queries, size_t first, size_t requests, size_t depth, ConnectionResult& result) {
+    int fd = connectTo(path);
+    if (fd < 0) {
+        result.failed = true;
+        return;
+    }
+    result.latencies.reserve(requests);
+    deque<chrono::high_resolution_clock::time_point> sendTimes;
+    size_t sent = 0;
+    auto sendNext = [&]() {
+        sendTimes.push_back(chrono::high_resolution_clock::now());
+        return sendAll(fd, queries[(first + sent++) % queries.size()] + "\n");
+    };
+    while (sent < requests && sent < depth)
+        if (!sendNext()) result.failed = true;
+
+    string input;
+    size_t scanned = 0;
+    char buffer[1 << 16];
+    while (!result.failed && result.latencies.size() < requests) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            result.failed = true;
+            break;
+        }
+        input.append(buffer, n);
+        size_t end;
+        while ((end = input.find("\n\n", scanned)) != string::npos) {
+            result.latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::high_resolution_clock::now() - sendTimes.front()).count());
+            sendTimes.pop_front();
+            scanned = end + 2;
+            if (sent < requests && !sendNext()) result.failed = true;
+        }
+        input.erase(0, scanned);
+        scanned = input.empty() ? 0 : input.size() - 1;
+    }
+    sendAll(fd, "endofinput\n");
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "usage: " << argv[0] << " socket queries.txt [--connections N] [--depth D] [--requests N]\n";
+        return 1;
+    }
+    string path = argv[1];
+    size_t connectionCount = 4, depth = 16, requests = 100000;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--connections") connectionCount = max(1, stoi(argv[i + 1]));
+        else if (arg == "--depth") depth = max(1, stoi(argv[i + 1]));
+        else if (arg == "--requests") requests = max(1, stoi(argv[i + 1]));
+    }
+
+    vector<string> queries;
+    ifstream file(argv[2]);
+    string line;
+    while (getline(file, line))
+        if (!line.empty()) queries.push_back(line);
+    if (queries.empty()) {
+        cout << argv[2] << " has no queries!\n";
+        return 1;
+    }
+
+    vector<ConnectionResult> results(connectionCount);
+    vector<thread> threads;
+    auto start = chrono::high_resolution_clock::now();
+    for (size_t c = 0; c < connectionCount; c++) {
+        size_t share = requests / connectionCount + (c < requests % connectionCount ? 1 : 0);
+        threads.emplace_back(runConnection, cref(path), cref(queries), c * queries.size() / connectionCount, share, depth, ref(results[c]));
+    }
+    for (auto& t : threads) t.join();
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start);
+
+    vector<long long> latencies;
+    size_t failed = 0;
+    for (const auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        if (result.failed) failed++;
+    }
+    if (latencies.empty()) {
+        cout << "No answers from " << path << "\n";
+        return 1;
+    }
+    sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    cout << n << " answers on " << connectionCount << " connections, " << depth << " in flight each, in "
+        << elapsed.count() / 1000.0 << " ms" << (failed > 0 ? ", " + to_string(failed) + " connections failed" : "") << "\n";
+    cout << "throughput: " << n / (elapsed.count() / 1e6) << " queries/s\n";
+    cout << "latency: p50 " << latencies[n / 2] / 1000.0 << " us, p99 " << latencies[n - 1 - n / 100] / 1000.0
+        << " us, p99.9 " << latencies[n - 1 - n / 1000] / 1000.0 << " us, max " << latencies.back() / 1000.0 << " us\n";
+    return failed > 0 ? 1 : 0;
+}